@@ -20,12 +20,14 @@
 #include <mach/dma.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#include <linux/completion.h>
 #include <asm/cacheflush.h>
 
 #include "defs.h"
 
-static int nanddma_completed_flag = 1;
-static DECLARE_WAIT_QUEUE_HEAD(DMA_wait);
+// completed by buffdone of the transfer in flight, the NFC engine
+// only has one transfer at a time
+static DECLARE_COMPLETION(nanddma_done);
 
 static struct sw_dma_client nand_dma_client = {
 	.name="NAND_DMA",
@@ -33,17 +35,13 @@ static struct sw_dma_client nand_dma_client = {
 
 static void nanddma_buffdone(struct sw_dma_chan * ch, void *buf, int size, enum sw_dma_buffresult result)
 {
-	nanddma_completed_flag = 1;
-	wake_up(&DMA_wait);
-	//DBG_INFO("buffer done. nanddma_completed_flag: %d\n", nanddma_completed_flag);
+	complete(&nanddma_done);
+	//DBG_INFO("buffer done\n");
 }
 
 static int nanddma_opfn(struct sw_dma_chan * ch,   enum sw_chan_op op_code)
 {
-	if(op_code == SW_DMAOP_START)
-		nanddma_completed_flag = 0;
-
-	//DBG_INFO("buffer opfn: %d, nanddma_completed_flag: %d\n", (int)op_code, nanddma_completed_flag);
+	//DBG_INFO("buffer opfn: %d\n", (int)op_code);
 
 	return 0;
 }
@@ -79,7 +77,7 @@ static int dma_enqueue(int hDma, unsigned int buff_addr, size_t len)
 {
 	static int seq=0;
 	__cpuc_flush_dcache_area((void *)buff_addr, len + (1 << 5) * 2 - 2);
-	nanddma_completed_flag = 0;
+	INIT_COMPLETION(nanddma_done);
 	return sw_dma_enqueue(hDma, (void*)(seq++), buff_addr, len);
 }
 
@@ -110,7 +108,7 @@ void dma_nand_config_start(int dma, int rw, unsigned int buff_addr, size_t len)
 
 int dma_nand_wait_finish(void)
 {
-	wait_event(DMA_wait, nanddma_completed_flag);
+	wait_for_completion(&nanddma_done);
     return 0;
 }
 
@@ -59,7 +59,7 @@ static int __devinit nand_probe(struct platform_device *pdev)
 	}
 
 	// first scan to find the device and get the page size
-	if ((err = nand_scan_ident(&info->mtd, 1, NULL)) < 0) {
+	if ((err = nand_scan_ident(&info->mtd, nfc_max_chips(), NULL)) < 0) {
 		ERR_INFO("nand scan ident fail\n");
 		goto out_nfc_exit;
 	}
@@ -76,6 +76,9 @@ static int __devinit nand_probe(struct platform_device *pdev)
 		goto out_nfc_exit;
 	}
 
+	// driver's own MTD ops over nand_base ones
+	nfc_setup_mtd_ops(&info->mtd);
+
 	if ((err = mtd_device_parse_register(&info->mtd, NULL, NULL, NULL, 0)) < 0) {
 		ERR_INFO("register mtd device fail\n");
 		goto out_release_nand;
@@ -23,7 +23,7 @@
 //============================ SAMSUNG NAND FLASH ==============================
 //==============================================================================
 static struct nand_chip_param samsung_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
 	//---------------------------------------------------------------------------------------
     { {0xec, 0xf1, 0xff, 0x15, 0xff, 0xff, 0xff, 0xff }, 4,     15,     0 },   // K9F1G08
     { {0xec, 0xf1, 0x00, 0x95, 0xff, 0xff, 0xff, 0xff }, 4,     15,     0 },   // K9F1G08
@@ -52,17 +52,19 @@ static struct nand_chip_param samsung_chip_param[] = {
     { {0xec, 0xd5, 0x98, 0x71, 0xff, 0xff, 0xff, 0xff }, 4,     30,     3 },   // K9AAG08
 
     { {0xec, 0xd5, 0x94, 0x29, 0xff, 0xff, 0xff, 0xff }, 4,     30,     0 },   // K9GAG08U0D
-    { {0xec, 0xd5, 0x84, 0x72, 0xff, 0xff, 0xff, 0xff }, 4,     24,     2 },   // K9GAG08U0E
-	{ {0xec, 0xd5, 0x94, 0x76, 0x54, 0xff, 0xff, 0xff }, 5,     30,     2 },   // K9GAG08U0E
+    { {0xec, 0xd5, 0x84, 0x72, 0xff, 0xff, 0xff, 0xff }, 4,     24,     2, SUNXI_NAND_TWO_PLANE },   // K9GAG08U0E
+	{ {0xec, 0xd5, 0x94, 0x76, 0x54, 0xff, 0xff, 0xff }, 5,     30,     2, SUNXI_NAND_TWO_PLANE },   // K9GAG08U0E
     { {0xec, 0xd3, 0x84, 0x72, 0xff, 0xff, 0xff, 0xff }, 4,     24,     2 },   // K9G8G08U0C
-	{ {0xec, 0xd7, 0x94, 0x76, 0xff, 0xff, 0xff, 0xff }, 4,     30,     3 },   // K9GBG08U0A
-	{ {0xec, 0xd7, 0x94, 0x7A, 0xff, 0xff, 0xff, 0xff }, 4,     30,     3 },   // K9GBG08U0A
+	{ {0xec, 0xd7, 0x94, 0x76, 0xff, 0xff, 0xff, 0xff }, 4,     30,     3, SUNXI_NAND_TWO_PLANE },   // K9GBG08U0A
+	// toggle 1.0 part of the K9GBG08U0A entry below, which matched it first, so
+	// keep that ECC mode and planes
+	{ {0xec, 0xd7, 0x94, 0x7A, 0x54, 0xc3, 0xff, 0xff }, 6,     60,     3, SUNXI_NAND_TWO_PLANE | SUNXI_NAND_TOGGLE },   // toogle nand 1.0
+	{ {0xec, 0xd7, 0x94, 0x7A, 0xff, 0xff, 0xff, 0xff }, 4,     30,     3, SUNXI_NAND_TWO_PLANE },   // K9GBG08U0A
 	{ {0xec, 0xde, 0xd5, 0x7A, 0x58, 0xff, 0xff, 0xff }, 5,     30,	    3 },   // K9LCG08U0A
 
-	{ {0xec, 0xd7, 0x94, 0x7A, 0x54, 0xc3, 0xff, 0xff }, 6,     60,     1 },   // toogle nand 1.0
-	{ {0xec, 0xde, 0xa4, 0x7a, 0x68, 0xc4, 0xff, 0xff }, 6,     60,     4 },   // toogle nand 2.0 K9GCGD8U0A
-	{ {0xec, 0xd7, 0x94, 0x7E, 0x64, 0xc4, 0xff, 0xff }, 6,     60,     4 },   // toogle nand 2.0 K9GBGD8U0B
-    { {0xec, 0xd7, 0x94, 0x7e, 0x64, 0x44, 0xff, 0xff }, 6,     40,     4 },   // 21nm sdr K9GBG08U0B
+	{ {0xec, 0xde, 0xa4, 0x7a, 0x68, 0xc4, 0xff, 0xff }, 6,     60,     4, SUNXI_NAND_TOGGLE },   // toogle nand 2.0 K9GCGD8U0A
+	{ {0xec, 0xd7, 0x94, 0x7E, 0x64, 0xc4, 0xff, 0xff }, 6,     60,     4, SUNXI_NAND_TOGGLE },   // toogle nand 2.0 K9GBGD8U0B
+    { {0xec, 0xd7, 0x94, 0x7e, 0x64, 0x44, 0xff, 0xff }, 6,     40,     4, SUNXI_NAND_TWO_PLANE },   // 21nm sdr K9GBG08U0B
 
 	//---------------------------------------------------------------------------------------
 	{ {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, 0,     0,      0 },
@@ -72,7 +74,7 @@ static struct nand_chip_param samsung_chip_param[] = {
 //============================= HYNIX NAND FLASH ===============================
 //==============================================================================
 static struct nand_chip_param hynix_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
     //-------------------------------------------------------------------------------------------------------
     { {0xad, 0xf1, 0x80, 0x15, 0xff, 0xff, 0xff, 0xff }, 4,     15,     0 },   // HY27UF081G2M
     { {0xad, 0xf1, 0x80, 0x1d, 0xff, 0xff, 0xff, 0xff }, 4,     20,     0 },   // HY27UF081G2A
@@ -104,14 +106,14 @@ static struct nand_chip_param hynix_chip_param[] = {
     { {0xad, 0xd7, 0x95, 0x25, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2 },   // H27UCG8V5A
     { {0xad, 0xd5, 0x95, 0x25, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2 },   // H27UCG8VFA
     { {0xad, 0xd5, 0x94, 0x9A, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2 },   // H27UAG8T2B
-    { {0xad, 0xd7, 0x94, 0x9A, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2 },   // H27UBG8T2A H27UCG8U5(D)A H27UDG8VF(D)A
+    { {0xad, 0xd7, 0x94, 0x9A, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2, SUNXI_NAND_TWO_PLANE },   // H27UBG8T2A H27UCG8U5(D)A H27UDG8VF(D)A
     { {0xad, 0xde, 0xd5, 0x9A, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2 },   // H27UDG8V5A
     { {0xad, 0xd7, 0x94, 0x25, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2 },   // H27UBG8T2M
     { {0xad, 0xde, 0x94, 0xd2, 0xff, 0xff, 0xff, 0xff }, 4,     30,     2 },   // H27UCG8T2M
     { {0xad, 0xd7, 0x18, 0x8d, 0xff, 0xff, 0xff, 0xff }, 4,     30,     3 },   // H27UBG8M2A
     { {0xad, 0xd7, 0x94, 0xda, 0xff, 0xff, 0xff, 0xff }, 4,     30,     3 },   // H27UBG8M2A
-    { {0xad, 0xde, 0x94, 0xda, 0x74, 0xff, 0xff, 0xff }, 5,     40,     4 },   // H27UCG8T2A
-    { {0xad, 0xd7, 0x94, 0x91, 0x60, 0xff, 0xff, 0xff }, 5,     40,     4 },   // H27UBG8T2C
+    { {0xad, 0xde, 0x94, 0xda, 0x74, 0xff, 0xff, 0xff }, 5,     40,     4, SUNXI_NAND_TWO_PLANE },   // H27UCG8T2A
+    { {0xad, 0xd7, 0x94, 0x91, 0x60, 0xff, 0xff, 0xff }, 5,     40,     4, SUNXI_NAND_TWO_PLANE },   // H27UBG8T2C
     //--------------------------------------------------------------------------------------------------------
     { {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, 0,     0,      0 },   // NULL
 };
@@ -121,7 +123,7 @@ static struct nand_chip_param hynix_chip_param[] = {
 //============================= TOSHIBA NAND FLASH =============================
 //==============================================================================
 static struct nand_chip_param toshiba_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
     //------------------------------------------------------------------------------------------------------
     { {0x98, 0xf1, 0x80, 0x95, 0xff, 0xff, 0xff, 0xff }, 4,     20,     0 },   // TC58NVG0S3B
     { {0x98, 0xda, 0xff, 0x95, 0xff, 0xff, 0xff, 0xff }, 4,     20,     0 },   // TC58NVG1S3B
@@ -152,7 +154,7 @@ static struct nand_chip_param toshiba_chip_param[] = {
 //============================= MICON NAND FLASH ===============================
 //==============================================================================
 static struct nand_chip_param micron_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
     //-------------------------------------------------------------------------------------------------------------------------
     { {0x2c, 0xda, 0xff, 0x15, 0xff, 0xff, 0xff, 0xff }, 4,	    25,	    0 },	 // MT29F2G08AAC, JS29F02G08AAN
 	{ {0x2c, 0xdc, 0xff, 0x15, 0xff, 0xff, 0xff, 0xff }, 4,		25,	    0 },	 // MT29F4G08BAB, MT29F8G08FAB, JS29F04G08BAN, JS29F08G08FAN
@@ -171,13 +173,13 @@ static struct nand_chip_param micron_chip_param[] = {
 	{ {0x2c, 0xd7, 0x94, 0x3e, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2 },	 // MT29F32G08CBAAA,MT29F64G08CFAAA
 	{ {0x2c, 0xd7, 0xd5, 0x3e, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2 },	 // MT29F64G08CTAA
 	{ {0x2c, 0xd9, 0xd5, 0x3e, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2 },	 // MT29F128G08,
-	{ {0x2c, 0x68, 0x04, 0x46, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2 },	 // MT29F32G08CBABA
-	{ {0x2c, 0x88, 0x05, 0xC6, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2 },	 // MT29F128G08CJABA
-	{ {0x2c, 0x88, 0x04, 0x4B, 0xff, 0xff, 0xff, 0xff }, 4,		40,	    2 },	 // MT29F64G08CBAAA
-	{ {0x2c, 0x68, 0x04, 0x4A, 0xff, 0xff, 0xff, 0xff }, 4,		40,	    2 },	 // MT29F32G08CBACA
-	{ {0x2c, 0x48, 0x04, 0x4A, 0xff, 0xff, 0xff, 0xff }, 4,		40,	    2 },	 // MT29F16G08CBACA
-	{ {0x2c, 0x48, 0x04, 0x46, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2 },	 // MT29F16G08CBABA
-	{ {0x2c, 0x64, 0x44, 0x4B, 0xA9, 0xff, 0xff, 0xff }, 5,		40,	    4 },	 // MT29F64G08CBABA
+	{ {0x2c, 0x68, 0x04, 0x46, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2, SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // MT29F32G08CBABA
+	{ {0x2c, 0x88, 0x05, 0xC6, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2, SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // MT29F128G08CJABA
+	{ {0x2c, 0x88, 0x04, 0x4B, 0xff, 0xff, 0xff, 0xff }, 4,		40,	    2, SUNXI_NAND_TWO_PLANE | SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // MT29F64G08CBAAA
+	{ {0x2c, 0x68, 0x04, 0x4A, 0xff, 0xff, 0xff, 0xff }, 4,		40,	    2, SUNXI_NAND_TWO_PLANE | SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // MT29F32G08CBACA
+	{ {0x2c, 0x48, 0x04, 0x4A, 0xff, 0xff, 0xff, 0xff }, 4,		40,	    2, SUNXI_NAND_TWO_PLANE | SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // MT29F16G08CBACA
+	{ {0x2c, 0x48, 0x04, 0x46, 0xff, 0xff, 0xff, 0xff }, 4,		30,	    2, SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // MT29F16G08CBABA
+	{ {0x2c, 0x64, 0x44, 0x4B, 0xA9, 0xff, 0xff, 0xff }, 5,		40,	    4, SUNXI_NAND_TWO_PLANE | SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // MT29F64G08CBABA
 	//-------------------------------------------------------------------------------------------------------------------------
     { {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, 0,     0,      0 },     // NULL
 };
@@ -187,7 +189,7 @@ static struct nand_chip_param micron_chip_param[] = {
 //============================= INTEL NAND FLASH ===============================
 //==============================================================================
 static struct nand_chip_param intel_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
     //-------------------------------------------------------------------------------------------------------------
 	{ {0x89, 0xd3, 0x94, 0xa5, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    0 },	 // 29F08G08AAMB2, 29F16G08CAMB2
 	{ {0x89, 0xd5, 0xd5, 0xa5, 0xff, 0xff, 0xff, 0xff }, 4,	    20,	    0 },	 // 29F32G08FAMB2
@@ -195,9 +197,9 @@ static struct nand_chip_param intel_chip_param[] = {
 	{ {0x89, 0xd7, 0x94, 0x3e, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2 },	 // MLC32GW8IMA,MLC64GW8IMA, 29F32G08AAMD2, 29F64G08CAMD2
 	{ {0x89, 0xd5, 0x94, 0x3e, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2 },	 // 29F32G08CAMC1
 	{ {0x89, 0xd7, 0xd5, 0x3e, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2 },	 // 29F64G08FAMC1
-	{ {0x89, 0x68, 0x04, 0x46, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2 },	 // 29F32G08AAMDB
-	{ {0x89, 0x88, 0x24, 0x4B, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2 },	 //	29F64G08CBAAA 29F64G083AME1
-	{ {0x89, 0xA8, 0x25, 0xCB, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2 },	 //	29F64G08CBAAA 29F64G083AME1
+	{ {0x89, 0x68, 0x04, 0x46, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2, SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 // 29F32G08AAMDB
+	{ {0x89, 0x88, 0x24, 0x4B, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2, SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 //	29F64G08CBAAA 29F64G083AME1
+	{ {0x89, 0xA8, 0x25, 0xCB, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    2, SUNXI_NAND_CACHE_READ | SUNXI_NAND_CACHE_PROG },	 //	29F64G08CBAAA 29F64G083AME1
 	//-------------------------------------------------------------------------------------------------------------
 	{ {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, 0,		0,	    0 },   // NULL
 };
@@ -207,7 +209,7 @@ static struct nand_chip_param intel_chip_param[] = {
 //=============================== ST NAND FLASH ================================
 //==============================================================================
 static struct nand_chip_param st_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
     //----------------------------------------------------------------------------------------
     { {0x20, 0xf1, 0x80, 0x15, 0xff, 0xff, 0xff, 0xff }, 4,	    15,	    0 },  // NAND01GW3B
 	{ {0x20, 0xf1, 0x00, 0x1d, 0xff, 0xff, 0xff, 0xff }, 4,	    15,	    0 },  // NAND01G001
@@ -227,7 +229,7 @@ static struct nand_chip_param st_chip_param[] = {
 //============================ SPANSION NAND FLASH ==============================
 //==============================================================================
 static struct nand_chip_param spansion_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
     //-----------------------------------------------------------------------------------------------
     { {0x01, 0xaa, 0x10, 0x00, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    0 },	 // S39MS02G
 	{ {0x01, 0xa1, 0x10, 0x00, 0xff, 0xff, 0xff, 0xff }, 4,	    30,	    0 },	 // S39MS01G
@@ -240,7 +242,7 @@ static struct nand_chip_param spansion_chip_param[] = {
 //============================ POWER NAND FLASH ==============================
 //==============================================================================
 static struct nand_chip_param power_chip_param[] = {
-	// id id_len clock_freq ecc_mode
+	// id id_len clock_freq ecc_mode options
     //------------------------------------------------------------------------------------
     { {0x92, 0xf1, 0x80, 0x95, 0x40, 0xff, 0xff, 0xff }, 5,     30,     0 },   // ASU1GA
     //------------------------------------------------------------------------------------
@@ -25,8 +25,15 @@ struct nand_chip_param {
 	int id_len;
 	int clock_freq; //the highest access frequence of the nand flash chip, based on MHz
 	int ecc_mode;   //the Ecc Mode for the nand flash chip, 0: bch-16, 1:bch-28, 2:bch_32
+	int options;    //the capability of the nand flash chip, SUNXI_NAND_*
 };
 
+// options
+#define SUNXI_NAND_TWO_PLANE     (1 << 0)  //two-plane page read/program and block erase
+#define SUNXI_NAND_CACHE_READ    (1 << 1)  //sequential cache read 31h/3Fh
+#define SUNXI_NAND_CACHE_PROG    (1 << 2)  //cache program 15h
+#define SUNXI_NAND_TOGGLE        (1 << 3)  //toggle DDR data interface, clock_freq is of it
+
 struct nand_chip_param *sunxi_get_nand_chip_param(unsigned char mf);
 
 #endif
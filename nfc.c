@@ -24,13 +24,46 @@
 #include <linux/mtd/nand.h>
 #include <linux/slab.h>
 #include <linux/interrupt.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
 #include <linux/dma-mapping.h>
+#include <linux/debugfs.h>
 #include <plat/sys_config.h>
 
 #include "defs.h"
 #include "regs.h"
 #include "dma.h"
 #include "nand_id.h"
+#include "nfc.h"
+
+// DMA buffer alignment, cache line size
+#define DMA_ALIGN (1 << 5)
+
+// ONFI two-plane commands
+#define NAND_CMD_MULTI_PLANE_READ   0x32
+#define NAND_CMD_MULTI_PLANE_PROG   0x11
+#define NAND_CMD_MULTI_PLANE_ERASE  0xd1
+// ONFI change read column enhanced, select the plane to output data
+#define NAND_CMD_RNDOUT_PLANE       0x06
+// cache read: move the page to cache register and load the next page
+// (31h) or nothing (3Fh) to the page register
+#define NAND_CMD_READ_CACHE_SEQ     0x31
+#define NAND_CMD_READ_CACHE_END     0x3f
+// ONFI SET/GET FEATURES, not in older nand.h
+#ifndef NAND_CMD_SET_FEATURES
+#define NAND_CMD_SET_FEATURES       0xef
+#endif
+#ifndef NAND_CMD_GET_FEATURES
+#define NAND_CMD_GET_FEATURES       0xee
+#endif
+// ONFI feature of timing mode, P1 is the mode
+#ifndef ONFI_FEATURE_ADDR_TIMING_MODE
+#define ONFI_FEATURE_ADDR_TIMING_MODE 0x01
+#endif
+#define ONFI_FEATURE_PARAM_LEN      4
+
+// fastest NFC clock (MHz) of SDR data interface
+#define NFC_SDR_MAX_CLOCK 30
 
 // do we need to consider exclusion of offset?
 // it should be in high level that the nand_chip ops have been
@@ -48,8 +81,63 @@ static dma_addr_t write_buffer_dma;
 static int dma_hdle;
 static struct nand_ecclayout sunxi_ecclayout;
 static DECLARE_WAIT_QUEUE_HEAD(nand_rb_wait);
+static DECLARE_WAIT_QUEUE_HEAD(nand_cmd_wait);
+static int nand_cmd_done = 0;
+// interrupts enabled in NFC_REG_INT besides the temporary B2R one
+static uint32_t nfc_int_mask = 0;
 static int program_column = -1, program_page = -1;
+// status of the last program/erase got by its op, -1 for none
+static int prog_status = -1;
+// data of the last normal command copied from RAM0, as other ops may
+// overwrite RAM0 before nfc_read_byte()/nfc_read_buf() are called
+static uint8_t cmd_data[1024] __aligned(4);
+// where nfc_read_byte()/nfc_read_buf() read from, cmd_data or read_buffer
+static uint8_t *read_data = cmd_data;
+static int read_data_size = 0;
+static int erase_page = -1;
 static int sunxi_nand_read_page_addr = 0;
+// READ0 sent but page data of read_page_addr not transferred yet
+static int read_page_pending = 0, read_page_addr = 0;
+// page to program set by nfc_write_page()
+static const uint8_t *program_buf = NULL, *program_oob = NULL;
+// two-plane mode: one MTD page is the same page of the two planes (the
+// even and odd block of a block pair), one MTD block is the block pair
+static int plane_num = 1;
+// ONFI (Micron/Intel) two-plane command set, or Samsung/Hynix one
+static int onfi_plane_cmd = 0;
+// size of a page of a single plane, which the NFC is set up with
+static int phys_writesize = 0, phys_oobsize = 0;
+static int block_page_shift = 0;
+// chip interleave mode: one MTD page is the same page of all chips
+static int way_num = 1;
+// chip (CE) selected
+static int cur_chip = 0;
+// cache read is used for page reads
+static int cache_read_on = 0;
+// page being loaded to page register by 31h, -1 for not in cache read
+static int cache_read_page = -1;
+// 15h sent, the chip may be still programming from page register
+static int cache_prog_pending = 0;
+// the last page of nfc_write_page_cached() was 15h, the next page status
+// tells failure of the one before too
+static int cache_prog_run = 0;
+// toggle DDR data interface is used
+static int toggle_on = 0;
+// unaligned MTD reads transfer the last page only up to the needed sector
+static int short_read_on = 0;
+// the short read in progress, protected by multipage_lock: the last
+// page of the read, sectors of it to transfer, and whether it was read
+static struct short_read {
+	struct task_struct *task;
+	int page, sectors;
+	int done;
+} short_read;
+// the sub-page write in progress, protected by subpage_lock: byte range
+// [start, end) of the MTD write
+static struct subpage_write {
+	struct task_struct *task;
+	loff_t start, end;
+} subpage;
 
 unsigned int hwecc_switch = 1;
 module_param(hwecc_switch, uint, 0);
@@ -63,6 +151,146 @@ unsigned int random_switch = 0;
 module_param(random_switch, uint, 0);
 MODULE_PARM_DESC(random_switch, "random read/write switch, 1=on, 0=off");
 
+unsigned int read_bounce_count = 0;
+module_param(read_bounce_count, uint, S_IRUGO);
+MODULE_PARM_DESC(read_bounce_count, "page reads through bounce buffer as caller buffer is not DMA-able");
+
+unsigned int write_bounce_count = 0;
+module_param(write_bounce_count, uint, S_IRUGO);
+MODULE_PARM_DESC(write_bounce_count, "page programs through bounce buffer as caller buffer is not DMA-able");
+
+unsigned int irq_switch = 0;
+module_param(irq_switch, uint, 0);
+MODULE_PARM_DESC(irq_switch, "wait command finish by interrupt, 1=interrupt, 0=polling");
+
+unsigned int multiplane_switch = 0;
+module_param(multiplane_switch, uint, 0);
+MODULE_PARM_DESC(multiplane_switch, "two-plane read/program/erase for capable chips (doubles page and block size), 1=on, 0=off");
+
+unsigned int interleave_switch = 0;
+module_param(interleave_switch, uint, 0);
+MODULE_PARM_DESC(interleave_switch, "interleave program/erase across chips (page and block size multiplied by chip number), 1=on, 0=off");
+
+unsigned int subpage_switch = 0;
+module_param(subpage_switch, uint, 0);
+MODULE_PARM_DESC(subpage_switch, "sub-page write in 1K ECC sectors for SLC chips (changes UBI sub-page size), 1=on, 0=off");
+
+unsigned int cache_read_switch = 0;
+module_param(cache_read_switch, uint, 0);
+MODULE_PARM_DESC(cache_read_switch, "cache read for sequential pages of capable chips, 1=on, 0=off");
+
+unsigned int cache_read_count = 0;
+module_param(cache_read_count, uint, S_IRUGO);
+MODULE_PARM_DESC(cache_read_count, "pages read from cache register loaded during the previous page transfer");
+
+unsigned int cache_prog_switch = 0;
+module_param(cache_prog_switch, uint, 0);
+MODULE_PARM_DESC(cache_prog_switch, "cache program for sequential pages of capable chips, 1=on, 0=off");
+
+unsigned int cache_prog_count = 0;
+module_param(cache_prog_count, uint, S_IRUGO);
+MODULE_PARM_DESC(cache_prog_count, "pages programmed by cache program (15h)");
+
+unsigned int sched_max_bypass = 8;
+module_param(sched_max_bypass, uint, 0);
+MODULE_PARM_DESC(sched_max_bypass, "times a queued program/erase can be overtaken by reads before it runs in order");
+
+unsigned int sched_stats_switch = 0;
+module_param(sched_stats_switch, uint, 0);
+MODULE_PARM_DESC(sched_stats_switch, "keep the sched_* queue depth and wait statistics, 1=on, 0=off");
+
+unsigned int sched_queue_depth = 0;
+module_param(sched_queue_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(sched_queue_depth, "NFC ops currently waiting in the queue");
+
+unsigned int sched_queue_depth_max = 0;
+module_param(sched_queue_depth_max, uint, S_IRUGO);
+MODULE_PARM_DESC(sched_queue_depth_max, "max NFC ops ever waiting in the queue");
+
+unsigned int sched_read_count = 0;
+module_param(sched_read_count, uint, S_IRUGO);
+MODULE_PARM_DESC(sched_read_count, "read ops run by the NFC");
+
+// total time (us) read ops waited for the NFC, in debugfs as a 32-bit
+// module parameter wraps in hours
+static u64 sched_read_wait_us = 0;
+static struct dentry *nfc_debugfs = NULL;
+
+unsigned int sched_read_wait_us_max = 0;
+module_param(sched_read_wait_us_max, uint, S_IRUGO);
+MODULE_PARM_DESC(sched_read_wait_us_max, "max time (us) a read op waited for the NFC");
+
+unsigned int sched_write_wait_us_max = 0;
+module_param(sched_write_wait_us_max, uint, S_IRUGO);
+MODULE_PARM_DESC(sched_write_wait_us_max, "max time (us) a program/erase op waited for the NFC");
+
+unsigned int read_latency_switch = 0;
+module_param(read_latency_switch, uint, 0);
+MODULE_PARM_DESC(read_latency_switch, "record MTD read latency in read_latency_hist, 1=on, 0=off");
+
+// MTD read latency, bucket i for [2^i, 2^(i+1)) us
+#define READ_LATENCY_BUCKETS 16
+static unsigned int read_latency_hist[READ_LATENCY_BUCKETS];
+module_param_array(read_latency_hist, uint, NULL, S_IRUGO);
+MODULE_PARM_DESC(read_latency_hist, "MTD read latency histogram, bucket i counts [2^i, 2^(i+1)) us, last bucket is open");
+
+unsigned int multipage_switch = 0;
+module_param(multipage_switch, uint, 0);
+MODULE_PARM_DESC(multipage_switch, "read page aligned runs of pages with row auto increment, 1=on, 0=off");
+
+unsigned int multipage_read_count = 0;
+module_param(multipage_read_count, uint, S_IRUGO);
+MODULE_PARM_DESC(multipage_read_count, "pages read by multi-page runs");
+
+unsigned int multipage_fallback_count = 0;
+module_param(multipage_fallback_count, uint, S_IRUGO);
+MODULE_PARM_DESC(multipage_fallback_count, "pages of multi-page runs read again alone for uncorrectable sectors");
+
+unsigned int short_read_count = 0;
+module_param(short_read_count, uint, S_IRUGO);
+MODULE_PARM_DESC(short_read_count, "pages read only up to the last sector an unaligned read needs");
+
+unsigned int toggle_switch = 0;
+module_param(toggle_switch, uint, 0);
+MODULE_PARM_DESC(toggle_switch, "toggle DDR data interface for toggle NAND chips, 1=on, 0=off (SDR)");
+
+unsigned int toggle_dqs_delay = 0x10;
+module_param(toggle_dqs_delay, uint, 0);
+MODULE_PARM_DESC(toggle_dqs_delay, "DQS delay chain (0-63) of toggle DDR data sampling");
+
+int calibrate_page = -1;
+module_param(calibrate_page, int, 0);
+MODULE_PARM_DESC(calibrate_page, "page of chip 0 with ECC data to calibrate NFC clock and timing on, the clock only steps down from the rated one, -1=off");
+
+unsigned int calibrate_margin = 4;
+module_param(calibrate_margin, uint, 0);
+MODULE_PARM_DESC(calibrate_margin, "clock (MHz) calibration backs off from the fastest stable one below the rated clock");
+
+// calibration result, given at load time to skip the sweep
+unsigned int calibrated_clock = 0;
+module_param(calibrated_clock, uint, S_IRUGO);
+MODULE_PARM_DESC(calibrated_clock, "NFC clock (MHz) found by calibration, capped at the rated clock when given, 0=not calibrated");
+
+int calibrated_timing_ctl = -1;
+module_param(calibrated_timing_ctl, int, S_IRUGO);
+MODULE_PARM_DESC(calibrated_timing_ctl, "NFC_REG_TIMING_CTL found by calibration, -1=default");
+
+int calibrated_timing_cfg = -1;
+module_param(calibrated_timing_cfg, int, S_IRUGO);
+MODULE_PARM_DESC(calibrated_timing_cfg, "NFC_REG_TIMING_CFG found by calibration, -1=default");
+
+unsigned int pio_threshold = 0;
+module_param(pio_threshold, uint, 0);
+MODULE_PARM_DESC(pio_threshold, "read a page by CPU sector by sector when at most this many bytes of it are read (short reads), 0=always DMA");
+
+unsigned int oob_dma_switch = 0;
+module_param(oob_dma_switch, uint, 0);
+MODULE_PARM_DESC(oob_dma_switch, "read OOB user data out of one 1K spare DMA instead of one command per sector when it fits, 1=on, 0=off");
+
+unsigned int bench_switch = 0;
+module_param(bench_switch, uint, 0);
+MODULE_PARM_DESC(bench_switch, "time NFC register setup at init for debug, 1=on, 0=off");
+
 //////////////////////////////////////////////////////////////////
 // SUNXI platform
 //
@@ -199,6 +427,49 @@ static void sunxi_release_nand_pio(void)
 // Utils
 //
 
+// Shadows of NFC_REG_CTL and NFC_REG_ECC_CTL, only the driver changes
+// them (but NFC_RESET) so they're never read back from the NFC. They're
+// written relaxed: accesses to the NFC stay in order, and send_cmd()'s
+// writel() orders DMA buffer writes before a command starts.
+static uint32_t nfc_ctl = 0, nfc_ecc_ctl = 0;
+
+static inline void write_ctl(uint32_t ctl)
+{
+	nfc_ctl = ctl;
+	writel_relaxed(ctl, NFC_REG_CTL);
+}
+
+static inline void write_ecc_ctl(uint32_t ctl)
+{
+	nfc_ecc_ctl = ctl;
+	writel_relaxed(ctl, NFC_REG_ECC_CTL);
+}
+
+// internal RAM accessed by DMA or by CPU through AHB
+static inline void set_ram_method(int dma)
+{
+	uint32_t ctl = dma ? (nfc_ctl | NFC_RAM_METHOD) : (nfc_ctl & ~NFC_RAM_METHOD);
+
+	if (ctl != nfc_ctl)
+		write_ctl(ctl);
+}
+
+// copy data of a command from RAM0 a word at a time, memcpy_fromio() of
+// ARM reads it byte by byte
+static void ram0_read(void *buf, int len)
+{
+	int i, words = len / 4;
+
+	if ((unsigned long)buf & 3) {
+		memcpy_fromio(buf, NFC_RAM0_BASE, len);
+		return;
+	}
+	for (i = 0; i < words; i++)
+		((uint32_t *)buf)[i] = readl_relaxed(NFC_RAM0_BASE + i * 4);
+	if (len & 3)
+		memcpy_fromio((uint8_t *)buf + words * 4, NFC_RAM0_BASE + words * 4, len & 3);
+}
+
 static inline void wait_cmdfifo_free(void)
 {
 	int timeout = 0xffff;
@@ -208,25 +479,96 @@ static inline void wait_cmdfifo_free(void)
 	}
 }
 
-static inline void wait_cmd_finish(void)
+// command interrupt is only enabled after IRQ is registered
+static inline int cmd_irq_on(void)
+{
+	return nfc_int_mask & NFC_CMD_INT_ENABLE;
+}
+
+static inline void send_cmd(uint32_t cfg)
+{
+	nand_cmd_done = 0;
+	writel(cfg, NFC_REG_CMD);
+}
+
+// 0 for finish, -ETIMEDOUT for not
+static inline int wait_cmd_finish(void)
 {
 	int timeout = 0xffff;
+
+	if (cmd_irq_on()) {
+		// CMD_INT_FLAG is cleared by the interrupt handler
+		if (!wait_event_timeout(nand_cmd_wait, nand_cmd_done, 1*HZ)) {
+			ERR_INFO("wait_cmd_finish timeout\n");
+			return -ETIMEDOUT;
+		}
+		return 0;
+	}
+
 	while((timeout--) && !(readl(NFC_REG_ST) & NFC_CMD_INT_FLAG));
 	if (timeout <= 0) {
 		ERR_INFO("wait_cmd_finish timeout\n");
-		return;
+		return -ETIMEDOUT;
 	}
 	writel(NFC_CMD_INT_FLAG, NFC_REG_ST);
+	return 0;
+}
+
+// send a command and wait it finish, -ETIMEDOUT for timeout
+static int run_cmd(uint32_t cfg)
+{
+	wait_cmdfifo_free();
+	send_cmd(cfg);
+	if (!cmd_irq_on())
+		wait_cmdfifo_free();
+	return wait_cmd_finish();
+}
+
+// The command FIFO takes a command while the NFC is still running the one
+// before. A command reads the parameter registers when it starts, so only
+// commands needing no new parameters, like D0h behind 60h-addr, are queued
+// with queue_cmd(). wait_cmds_finish() then waits the whole batch in one go.
+static void queue_cmd(uint32_t cfg)
+{
+	wait_cmdfifo_free();
+	send_cmd(cfg);
+}
+
+static inline int cmds_idle(uint32_t st)
+{
+	return !(readl(NFC_REG_ST) & (NFC_CMD_FIFO_STATUS | NFC_STA | st));
+}
+
+static void wait_cmds_finish(void)
+{
+	int timeout = 0xffff;
+
+	if (cmd_irq_on()) {
+		// every command of the batch wakes us up, done when no command is
+		// queued, running or has its interrupt not handled
+		if (!wait_event_timeout(nand_cmd_wait,
+								nand_cmd_done && cmds_idle(NFC_CMD_INT_FLAG), 1*HZ))
+			ERR_INFO("wait_cmds_finish timeout\n");
+		return;
+	}
+
+	while ((timeout--) && !cmds_idle(0));
+	if (timeout <= 0) {
+		ERR_INFO("wait_cmds_finish timeout\n");
+		return;
+	}
+	// clear the flag of the last command
+	wait_cmd_finish();
 }
 
 static void select_rb(int rb)
 {
 	uint32_t ctl;
 	// A10 has 2 RB pin
-	ctl = readl(NFC_REG_CTL);
+	ctl = nfc_ctl;
 	ctl &= ~NFC_RB_SEL;
 	ctl |= ((rb & 0x1) << 3);
-	writel(ctl, NFC_REG_CTL);
+	write_ctl(ctl);
 }
 
 // 1 for ready, 0 for not ready
@@ -235,56 +577,86 @@ static inline int check_rb_ready(int rb)
 	return (readl(NFC_REG_ST) & (NFC_RB_STATE0 << (rb & 0x3))) ? 1 : 0;
 }
 
+// RB pin of a chip, chips on odd CE use RB1
+static inline int chip_rb(int chip)
+{
+	return chip & 0x1;
+}
+
+// sleep until the RB goes ready, woken up by B2R interrupt
+static void wait_rb_ready(int rb)
+{
+	int err;
+
+	// B2R is of the selected RB
+	select_rb(rb);
+
+	// clear B2R interrupt state
+	writel(NFC_RB_B2R, NFC_REG_ST);
+
+	if (check_rb_ready(rb))
+		return;
+
+	// enable B2R interrupt
+	writel(nfc_int_mask | NFC_B2R_INT_ENABLE, NFC_REG_INT);
+	if ((err = wait_event_timeout(nand_rb_wait, check_rb_ready(rb), 1*HZ)) <= 0) {
+		DBG_INFO("nfc wait rb%d timeout %d\n", rb, err);
+	}
+	// disable B2R interrupt
+	writel(nfc_int_mask, NFC_REG_INT);
+}
+
 static void nand1k_enable_random(void)
 {
 	uint32_t ctl;
-	ctl = readl(NFC_REG_ECC_CTL);
+	ctl = nfc_ecc_ctl;
 	ctl |= NFC_RANDOM_EN;
 	ctl &= ~NFC_RANDOM_DIRECTION;
 	ctl &= ~NFC_RANDOM_SEED;
 	ctl |= (0x4a80 << 16);
-	writel(ctl, NFC_REG_ECC_CTL);
+	write_ecc_ctl(ctl);
 }
 
+// random seed of a page, indexed by page % 128
+static const uint16_t random_seed[128] = {
+	//0        1      2       3        4      5        6       7       8       9
+	0x2b75, 0x0bd0, 0x5ca3, 0x62d1, 0x1c93, 0x07e9, 0x2162, 0x3a72, 0x0d67, 0x67f9,
+	0x1be7, 0x077d, 0x032f, 0x0dac, 0x2716, 0x2436, 0x7922, 0x1510, 0x3860, 0x5287,
+	0x480f, 0x4252, 0x1789, 0x5a2d, 0x2a49, 0x5e10, 0x437f, 0x4b4e, 0x2f45, 0x216e,
+	0x5cb7, 0x7130, 0x2a3f, 0x60e4, 0x4dc9, 0x0ef0, 0x0f52, 0x1bb9, 0x6211, 0x7a56,
+	0x226d, 0x4ea7, 0x6f36, 0x3692, 0x38bf, 0x0c62, 0x05eb, 0x4c55, 0x60f4, 0x728c,
+	0x3b6f, 0x2037, 0x7f69, 0x0936, 0x651a, 0x4ceb, 0x6218, 0x79f3, 0x383f, 0x18d9,
+	0x4f05, 0x5c82, 0x2912, 0x6f17, 0x6856, 0x5938, 0x1007, 0x61ab, 0x3e7f, 0x57c2,
+	0x542f, 0x4f62, 0x7454, 0x2eac, 0x7739, 0x42d4, 0x2f90, 0x435a, 0x2e52, 0x2064,
+	0x637c, 0x66ad, 0x2c90, 0x0bad, 0x759c, 0x0029, 0x0986, 0x7126, 0x1ca7, 0x1605,
+	0x386a, 0x27f5, 0x1380, 0x6d75, 0x24c3, 0x0f8e, 0x2b7a, 0x1418, 0x1fd1, 0x7dc1,
+	0x2d8e, 0x43af, 0x2267, 0x7da3, 0x4e3d, 0x1338, 0x50db, 0x454d, 0x764d, 0x40a3,
+	0x42e6, 0x262b, 0x2d2e, 0x1aea, 0x2e17, 0x173d, 0x3a6e, 0x71bf, 0x25f9, 0x0a5d,
+	0x7c57, 0x0fbe, 0x46ce, 0x4939, 0x6b17, 0x37bb, 0x3e91, 0x76db
+};
+
 static void enable_random(uint32_t page)
 {
-	static const uint16_t random_seed[128] = {
-		//0        1      2       3        4      5        6       7       8       9
-		0x2b75, 0x0bd0, 0x5ca3, 0x62d1, 0x1c93, 0x07e9, 0x2162, 0x3a72, 0x0d67, 0x67f9,
-		0x1be7, 0x077d, 0x032f, 0x0dac, 0x2716, 0x2436, 0x7922, 0x1510, 0x3860, 0x5287,
-		0x480f, 0x4252, 0x1789, 0x5a2d, 0x2a49, 0x5e10, 0x437f, 0x4b4e, 0x2f45, 0x216e,
-		0x5cb7, 0x7130, 0x2a3f, 0x60e4, 0x4dc9, 0x0ef0, 0x0f52, 0x1bb9, 0x6211, 0x7a56,
-		0x226d, 0x4ea7, 0x6f36, 0x3692, 0x38bf, 0x0c62, 0x05eb, 0x4c55, 0x60f4, 0x728c,
-		0x3b6f, 0x2037, 0x7f69, 0x0936, 0x651a, 0x4ceb, 0x6218, 0x79f3, 0x383f, 0x18d9,
-		0x4f05, 0x5c82, 0x2912, 0x6f17, 0x6856, 0x5938, 0x1007, 0x61ab, 0x3e7f, 0x57c2,
-		0x542f, 0x4f62, 0x7454, 0x2eac, 0x7739, 0x42d4, 0x2f90, 0x435a, 0x2e52, 0x2064,
-		0x637c, 0x66ad, 0x2c90, 0x0bad, 0x759c, 0x0029, 0x0986, 0x7126, 0x1ca7, 0x1605,
-		0x386a, 0x27f5, 0x1380, 0x6d75, 0x24c3, 0x0f8e, 0x2b7a, 0x1418, 0x1fd1, 0x7dc1,
-		0x2d8e, 0x43af, 0x2267, 0x7da3, 0x4e3d, 0x1338, 0x50db, 0x454d, 0x764d, 0x40a3,
-		0x42e6, 0x262b, 0x2d2e, 0x1aea, 0x2e17, 0x173d, 0x3a6e, 0x71bf, 0x25f9, 0x0a5d,
-		0x7c57, 0x0fbe, 0x46ce, 0x4939, 0x6b17, 0x37bb, 0x3e91, 0x76db
-	};
-
 	uint32_t ctl;
-	ctl = readl(NFC_REG_ECC_CTL);
+	ctl = nfc_ecc_ctl;
 	ctl |= NFC_RANDOM_EN;
 	ctl &= ~NFC_RANDOM_DIRECTION;
 	ctl &= ~NFC_RANDOM_SEED;
 	ctl |= ((uint32_t)random_seed[page % 128] << 16);
-	writel(ctl, NFC_REG_ECC_CTL);
+	write_ecc_ctl(ctl);
 }
 
 static void disable_random(void)
 {
 	uint32_t ctl;
-	ctl = readl(NFC_REG_ECC_CTL);
+	ctl = nfc_ecc_ctl;
 	ctl &= ~NFC_RANDOM_EN;
-	writel(ctl, NFC_REG_ECC_CTL);
+	write_ecc_ctl(ctl);
 }
 
 static void enable_ecc(int pipline)
 {
-	uint32_t cfg = readl(NFC_REG_ECC_CTL);
+	uint32_t cfg = nfc_ecc_ctl;
 	if (pipline)
 		cfg |= NFC_ECC_PIPELINE;
 	else
@@ -299,26 +671,117 @@ static void enable_ecc(int pipline)
 	//cfg |= (1 << 1); 16 bit ecc
 
 	cfg |= NFC_ECC_EN;
-	writel(cfg, NFC_REG_ECC_CTL);
+	write_ecc_ctl(cfg);
 }
 
 static void set_ecc_mode(int mode)
 {
 	uint32_t ctl;
-	ctl = readl(NFC_REG_ECC_CTL);
+	ctl = nfc_ecc_ctl;
 	ctl &= ~NFC_ECC_MODE;
 	ctl |= mode << NFC_ECC_MODE_SHIFT;
-	writel(ctl, NFC_REG_ECC_CTL);
+	write_ecc_ctl(ctl);
 }
 
-int check_ecc(int eblock_cnt)
+// NFC_REG_ECC_CTL values of the page transfers of this chip, built by
+// nfc_build_xfer_desc() once the ECC mode is set, so a page transfer only
+// ors in the random seed instead of read-modify-write ECC_CTL 4 times
+static struct {
+	uint32_t ecc_ctl[2];	// during transfer, [0] without ECC, [1] with ECC
+	uint32_t ecc_ctl_idle;	// between transfers
+} xfer_desc;
+
+static void nfc_build_xfer_desc(void)
+{
+	uint32_t idle = nfc_ecc_ctl &
+		~(NFC_ECC_EN | NFC_ECC_PIPELINE | NFC_ECC_EXCEPTION |
+		  NFC_RANDOM_EN | NFC_RANDOM_DIRECTION | NFC_RANDOM_SEED);
+	uint32_t random = random_switch ? NFC_RANDOM_EN : 0;
+
+	xfer_desc.ecc_ctl_idle = idle;
+	xfer_desc.ecc_ctl[0] = idle | random;
+	// as enable_ecc(1), exception is off with random on
+	xfer_desc.ecc_ctl[1] = idle | random | NFC_ECC_EN | NFC_ECC_PIPELINE |
+		(random_switch ? 0 : NFC_ECC_EXCEPTION);
+	if (!hwecc_switch)
+		xfer_desc.ecc_ctl[1] = xfer_desc.ecc_ctl[0];
+}
+
+static inline void xfer_begin(uint32_t page_addr, int ecc)
+{
+	uint32_t ctl = xfer_desc.ecc_ctl[!!ecc];
+
+	if (random_switch)
+		ctl |= (uint32_t)random_seed[page_addr % 128] << 16;
+	write_ecc_ctl(ctl);
+}
+
+static inline void xfer_end(void)
+{
+	write_ecc_ctl(xfer_desc.ecc_ctl_idle);
+}
+
+// ECC parity bytes of a 1K sector in spare area for each ECC mode
+static const int ecc_parity_bytes[] = { 28, 42, 50, 56, 70, 84, 98, 106, 112 };
+
+// ECC state registers of a read, copied out so the next read can start
+// before they are decoded
+struct ecc_snapshot {
+	int page;
+	uint32_t ecc_st;
+	uint32_t ecc_cnt[4];
+};
+
+static void ecc_harvest(struct ecc_snapshot *snap, int eblock_cnt)
+{
+	int i;
+
+	snap->page = sunxi_nand_read_page_addr;
+	snap->ecc_st = readl(NFC_REG_ECC_ST) & 0xffff;
+	for (i = 0; i < (eblock_cnt + 3) / 4; i++)
+		snap->ecc_cnt[i] = readl(NFC_REG_ECC_CNT0 + i * 4);
+}
+
+// corrected bits of a sector, one ECC_CNT register holds 4 sectors
+static inline int ecc_sector_bits(const struct ecc_snapshot *snap, int i)
+{
+	return (snap->ecc_cnt[i / 4] >> ((i & 3) * 8)) & 0xff;
+}
+
+// An erased sector has no parity and fails ECC. It's told by its data
+// and user data having no more 0 bits than ECC corrects, and is given
+// as all 0xff then. The parity isn't transferred so its bitflips aren't
+// counted. Return the bitflips, -1 for a sector really uncorrectable.
+static int sector_erased_bits(uint8_t *data, uint32_t *user_data, int max_bits)
+{
+	int i, bits = hweight32(~*user_data);
+	const uint32_t *p = (const uint32_t *)data;
+
+	for (i = 0; i < 1024 / 4 && bits <= max_bits; i++)
+		bits += hweight32(~p[i]);
+	if (bits > max_bits)
+		return -1;
+
+	memset(data, 0xff, 1024);
+	*user_data = 0xffffffff;
+	return bits;
+}
+
+// decode ECC result of sector [first, eblock_cnt) of a snapshot, buf and
+// user_data are what the snapshot's read gave from sector 0, with them
+// (and data not randomized) erased sectors are told from broken ones
+static int ecc_decode(const struct ecc_snapshot *snap, int first, int eblock_cnt,
+					  uint8_t *buf, uint32_t *user_data)
 {
 	int i;
     int ecc_mode;
 	int max_ecc_bit_cnt = 16;
 	int cfg, corrected = 0;
+	uint32_t erased = 0;
+	// sector i of a multi-page run is in its (i / sectors)th page
+	int sectors = phys_writesize / 1024;
 
-	ecc_mode = (readl(NFC_REG_ECC_CTL) & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
+	ecc_mode = (nfc_ecc_ctl & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
 	if(ecc_mode == 0)
 		max_ecc_bit_cnt = 16;
 	if(ecc_mode == 1)
@@ -339,83 +802,1013 @@ int check_ecc(int eblock_cnt)
 		max_ecc_bit_cnt = 64;
 
 	//check ecc error
-	cfg = readl(NFC_REG_ECC_ST) & 0xffff;
-	for (i = 0; i < eblock_cnt; i++) {
+	cfg = snap->ecc_st;
+	for (i = first; i < eblock_cnt; i++) {
 		if (cfg & (1<<i)) {
-			ERR_INFO("ECC too many error at %x:%d\n", sunxi_nand_read_page_addr, i);
-			return -1;
+			int bits = -1;
+
+			if (buf && !random_switch)
+				bits = sector_erased_bits(buf + i * 1024, user_data + i, max_ecc_bit_cnt);
+			if (bits < 0) {
+				ERR_INFO("ECC too many error at %x:%d\n", snap->page + i / sectors, i % sectors);
+				return -1;
+			}
+			if (bits >= max_ecc_bit_cnt - 4)
+				corrected++;
+			erased |= 1 << i;
 		}
 	}
 
 	//check ecc limit
-	for (i = 0; i < eblock_cnt; i += 4) {
-		int j, n = (eblock_cnt - i) < 4 ? (eblock_cnt - i) : 4;
-		cfg = readl(NFC_REG_ECC_CNT0 + i);
-
-		for (j = 0; j < n; j++, cfg >>= 8) {
-			int bits = cfg & 0xff;
-            /*
-			if (bits) {
-				DBG_INFO("ECC bitflip happen at %x:%d\n", sunxi_nand_read_page_addr, j);
-			}
-			*/
-			if (bits >= max_ecc_bit_cnt - 4) {
-				DBG_INFO("ECC limit %d/%d at %x:%d\n", 
-						 bits, max_ecc_bit_cnt, 
-						 sunxi_nand_read_page_addr, j);
-				corrected++;
-			}
+	for (i = first; i < eblock_cnt; i++) {
+		int bits = ecc_sector_bits(snap, i);
+
+		if (erased & (1 << i))
+			continue;
+
+		/*
+		if (bits) {
+			DBG_INFO("ECC bitflip happen at %x:%d\n", snap->page, i);
+		}
+		*/
+		if (bits >= max_ecc_bit_cnt - 4) {
+			DBG_INFO("ECC limit %d/%d at %x:%d\n", 
+					 bits, max_ecc_bit_cnt, 
+					 snap->page + i / sectors, i % sectors);
+			corrected++;
 		}
 	}
 
 	return corrected;
 }
 
+// check ECC result of the first eblock_cnt sectors read to buf and
+// user_data, erased sectors are only told when buf is given
+static int check_ecc_read(int eblock_cnt, uint8_t *buf, uint32_t *user_data)
+{
+	struct ecc_snapshot snap;
+
+	ecc_harvest(&snap, eblock_cnt);
+	return ecc_decode(&snap, 0, eblock_cnt, buf, user_data);
+}
+
+int check_ecc(int eblock_cnt)
+{
+	return check_ecc_read(eblock_cnt, NULL, NULL);
+}
+
+// corrected bits of the first eblock_cnt sectors, -1 for uncorrectable
+static int ecc_bitflips(int eblock_cnt)
+{
+	struct ecc_snapshot snap;
+	int i, bits = 0;
+
+	ecc_harvest(&snap, eblock_cnt);
+	if (snap.ecc_st & ((1 << eblock_cnt) - 1))
+		return -1;
+
+	for (i = 0; i < eblock_cnt; i++)
+		bits += ecc_sector_bits(&snap, i);
+	return bits;
+}
+
 static void disable_ecc(void)
 {
-	uint32_t cfg = readl(NFC_REG_ECC_CTL);
+	uint32_t cfg = nfc_ecc_ctl;
 	cfg &= (~NFC_ECC_EN) & 0xffffffff;
-	writel(cfg, NFC_REG_ECC_CTL);
+	write_ecc_ctl(cfg);
+}
+
+/////////////////////////////////////////////////////////////////
+// NFC arbitration lock
+//
+// Everything touching the NFC registers is a nfc_op run by nfc_op_run()
+// under the NFC arbitration lock. It's a lock with priority order, not
+// an asynchronous engine: each caller sleeps until its op is first in
+// the wait queue and the NFC is free, then runs the op in its own
+// context and releases the NFC. An op owns the NFC until it finishes, a
+// program or erase op until the chip is ready, as RB select and the
+// other registers are shared, so waiters wait up to tBERS behind an
+// erase. Ops must not submit ops themselves.
+//
+// Waiters are kept in priority order: reads (and the quick control ops)
+// go ahead of programs, programs ahead of erases, so a MTD read doesn't
+// wait behind a nand1k flashing batch. A program/erase overtaken
+// sched_max_bypass times is not overtaken any more. Each caller only
+// has one op of a sequence waiting, so reordering never breaks the
+// order of a single user. Queue and wait statistics are only kept with
+// sched_stats_switch on.
+
+static LIST_HEAD(nfc_op_queue);
+static DEFINE_SPINLOCK(nfc_op_lock);
+static DECLARE_WAIT_QUEUE_HEAD(nfc_op_wait);
+static int nfc_op_busy = 0;
+
+enum {
+	NFC_OP_CLASS_READ = 0,
+	NFC_OP_CLASS_PROG,
+	NFC_OP_CLASS_ERASE,
+};
+
+static int nfc_op_class(struct nfc_op *op)
+{
+	switch (op->command) {
+	case NAND_CMD_PAGEPROG:
+	case NAND_CMD_CACHEDPROG:
+		return NFC_OP_CLASS_PROG;
+	case NAND_CMD_ERASE1:
+	case NAND_CMD_ERASE2:
+		return NFC_OP_CLASS_ERASE;
+	default:
+		return NFC_OP_CLASS_READ;
+	}
+}
+
+// called with nfc_op_lock held
+static void nfc_op_enqueue(struct nfc_op *op)
+{
+	struct nfc_op *pos;
+	struct list_head *at = &nfc_op_queue;
+	int class = nfc_op_class(op);
+
+	list_for_each_entry(pos, &nfc_op_queue, list) {
+		if (nfc_op_class(pos) <= class || pos->bypass >= sched_max_bypass)
+			at = &pos->list;
+	}
+
+	// everything behind the new op has been overtaken
+	for (pos = list_entry(at->next, struct nfc_op, list);
+		 &pos->list != &nfc_op_queue;
+		 pos = list_entry(pos->list.next, struct nfc_op, list))
+		pos->bypass++;
+
+	list_add(&op->list, at);
+
+	if (sched_stats_switch && ++sched_queue_depth > sched_queue_depth_max)
+		sched_queue_depth_max = sched_queue_depth;
+}
+
+// called with nfc_op_lock held
+static struct nfc_op *nfc_op_dequeue(void)
+{
+	struct nfc_op *op;
+	unsigned int wait;
+
+	op = list_first_entry(&nfc_op_queue, struct nfc_op, list);
+	list_del(&op->list);
+	if (!sched_stats_switch)
+		return op;
+	sched_queue_depth--;
+
+	wait = ktime_us_delta(ktime_get(), op->submit_time);
+	if (nfc_op_class(op) == NFC_OP_CLASS_READ) {
+		sched_read_count++;
+		sched_read_wait_us += wait;
+		if (wait > sched_read_wait_us_max)
+			sched_read_wait_us_max = wait;
+	}
+	else if (wait > sched_write_wait_us_max)
+		sched_write_wait_us_max = wait;
+
+	return op;
+}
+
+// take the NFC for op if it's the op's turn, called with nfc_op_lock held
+static int __nfc_op_take(struct nfc_op *op)
+{
+	if (nfc_op_busy || list_first_entry(&nfc_op_queue, struct nfc_op, list) != op)
+		return 0;
+	nfc_op_dequeue();
+	nfc_op_busy = 1;
+	return 1;
+}
+
+static int nfc_op_take(struct nfc_op *op)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&nfc_op_lock, flags);
+	ret = __nfc_op_take(op);
+	spin_unlock_irqrestore(&nfc_op_lock, flags);
+	return ret;
+}
+
+// take the NFC lock for op, run it and return op->result
+int nfc_op_run(struct nfc_op *op)
+{
+	unsigned long flags;
+	int taken;
+
+	op->bypass = 0;
+	if (sched_stats_switch)
+		op->submit_time = ktime_get();
+
+	// a free NFC is taken at once
+	spin_lock_irqsave(&nfc_op_lock, flags);
+	nfc_op_enqueue(op);
+	taken = __nfc_op_take(op);
+	spin_unlock_irqrestore(&nfc_op_lock, flags);
+
+	if (!taken)
+		wait_event(nfc_op_wait, nfc_op_take(op));
+	op->run(op);
+
+	spin_lock_irqsave(&nfc_op_lock, flags);
+	nfc_op_busy = 0;
+	spin_unlock_irqrestore(&nfc_op_lock, flags);
+	// the new first op may be of any waiter
+	wake_up(&nfc_op_wait);
+
+	return op->result;
 }
 
 /////////////////////////////////////////////////////////////////
 // NFC
 //
 
-static void nfc_select_chip(struct mtd_info *mtd, int chip)
+// leave cache read, the chip may be still loading the next page to page
+// register which must finish before other commands
+static void nfc_cache_read_end(void)
+{
+	if (cache_read_page < 0)
+		return;
+	run_cmd(NAND_CMD_READ_CACHE_END | NFC_SEND_CMD1 | NFC_WAIT_FLAG);
+	cache_read_page = -1;
+}
+
+// status register read without going through nfc_cmdfunc(), a command
+// timeout is a failed status
+static uint8_t read_status(void)
+{
+	// switch to AHB
+	set_ram_method(0);
+	writel(1, NFC_REG_CNT);
+	if (run_cmd(NAND_CMD_STATUS | NFC_SEND_CMD1 | NFC_DATA_TRANS) < 0)
+		return NAND_STATUS_FAIL;
+	return readb(NFC_RAM0_BASE);
+}
+
+// 70h sent at once and the status byte read out after RB ready by the same
+// NFC command, only when the command finish sleeps on its interrupt, a
+// polled one would spin for the whole tPROG
+static uint8_t wait_read_status(void)
+{
+	// NFC_WAIT_FLAG is of the selected RB
+	select_rb(chip_rb(cur_chip));
+	set_ram_method(0);
+	writel(1, NFC_REG_CNT);
+	if (run_cmd(NAND_CMD_STATUS | NFC_SEND_CMD1 | NFC_WAIT_FLAG | NFC_DATA_TRANS) < 0)
+		return NAND_STATUS_FAIL;
+	return readb(NFC_RAM0_BASE);
+}
+
+// ONFI SET FEATURES EFh-addr-P1..P4 of the selected chip, busy for tFEAT.
+// Only used at init before the B2R interrupt is requested, so RB is polled.
+static void set_feature(int addr, const uint8_t *param)
+{
+	int timeout = 0xffff;
+
+	set_ram_method(0);
+	memcpy_toio(NFC_RAM0_BASE, param, ONFI_FEATURE_PARAM_LEN);
+	writel(addr, NFC_REG_ADDR_LOW);
+	writel(0, NFC_REG_ADDR_HIGH);
+	writel(ONFI_FEATURE_PARAM_LEN, NFC_REG_CNT);
+	run_cmd(NAND_CMD_SET_FEATURES | NFC_SEND_CMD1 | NFC_SEND_ADR | NFC_DATA_TRANS | NFC_ACCESS_DIR);
+	while ((timeout--) && !check_rb_ready(chip_rb(cur_chip)));
+	if (timeout <= 0) {
+		ERR_INFO("wait set feature timeout\n");
+	}
+}
+
+// ONFI GET FEATURES EEh-addr, P1..P4 out after tFEAT
+static void get_feature(int addr, uint8_t *param)
+{
+	set_ram_method(0);
+	writel(addr, NFC_REG_ADDR_LOW);
+	writel(0, NFC_REG_ADDR_HIGH);
+	writel(ONFI_FEATURE_PARAM_LEN, NFC_REG_CNT);
+	run_cmd(NAND_CMD_GET_FEATURES | NFC_SEND_CMD1 | NFC_SEND_ADR | NFC_DATA_TRANS | NFC_WAIT_FLAG);
+	ram0_read(param, ONFI_FEATURE_PARAM_LEN);
+}
+
+// after 15h the chip is ready for the next page but is still programming
+// the last one to array, wait for array ready before other commands
+static void nfc_cache_prog_end(void)
+{
+	int timeout = 0xffff;
+
+	if (!cache_prog_pending)
+		return;
+	while ((timeout--) && !(read_status() & NAND_STATUS_TRUE_READY));
+	if (timeout <= 0) {
+		ERR_INFO("wait cache program timeout\n");
+	}
+	cache_prog_pending = 0;
+}
+
+static void select_chip(int chip)
 {
 	uint32_t ctl;
+
+	// the chip in cache read/program is going to be deselected
+	nfc_cache_read_end();
+	nfc_cache_prog_end();
+
 	// A10 has 8 CE pin to support 8 flash chips
-    ctl = readl(NFC_REG_CTL);
+    ctl = nfc_ctl;
     ctl &= ~NFC_CE_SEL;
 	ctl |= ((chip & 7) << 24);
-    writel(ctl, NFC_REG_CTL);
+	// NFC_WAIT_FLAG and B2R interrupt are of the selected RB
+	if (chip >= 0) {
+		ctl &= ~NFC_RB_SEL;
+		ctl |= chip_rb(chip) << 3;
+		cur_chip = chip;
+	}
+    write_ctl(ctl);
 }
 
-static void nfc_cmdfunc(struct mtd_info *mtd, unsigned command, int column,
-						int page_addr)
+static void nfc_select_chip_op(struct nfc_op *op)
 {
-	int i;
-	uint32_t cfg = command;
-	int read_size, write_size, do_enable_ecc = 0, do_enable_random = 0;
-	int addr_cycle, wait_rb_flag, byte_count, sector_count;
-	addr_cycle = wait_rb_flag = byte_count = sector_count = 0;
+	select_chip(op->page);
+}
 
-	//DBG_INFO("command %x ...\n", command);
-	wait_cmdfifo_free();
+static void nfc_select_chip(struct mtd_info *mtd, int chip)
+{
+	struct nfc_op op = { .run = nfc_select_chip_op, .mtd = mtd, .command = NAND_CMD_NONE,
+						 .page = chip };
 
-	// switch to AHB
-	writel(readl(NFC_REG_CTL) & ~NFC_RAM_METHOD, NFC_REG_CTL);
+	nfc_op_run(&op);
 
-	switch (command) {
-	case NAND_CMD_RESET:
-	case NAND_CMD_ERASE2:
-		break;
-	case NAND_CMD_READID:
-		addr_cycle = 1;
-		// read 8 byte ID
-		byte_count = 8;
-		break;
+	// nand_base deselects the chip before releasing the device, a page
+	// read short must not stay as its page cache
+	if (chip < 0 && short_read.task == current && short_read.done) {
+		((struct nand_chip *)mtd->priv)->pagebuf = -1;
+		short_read.done = 0;
+	}
+}
+
+// DMA must not share cache line with others, and only works on
+// linear mapped memory (not vmalloc or highmem)
+static inline int dma_able(const void *buf, int len)
+{
+	return virt_addr_valid(buf) && virt_addr_valid(buf + len - 1) &&
+		IS_ALIGNED((unsigned long)buf, DMA_ALIGN) && IS_ALIGNED(len, DMA_ALIGN);
+}
+
+// read the first sector_count 1K sectors of a page with ECC, main data
+// DMA to buf, 4 bytes user data of each sector to user_data.
+// cmd1-addr-cmd2 starts the read, 00h-30h for normal page read, cmd2 < 0
+// for only selecting a plane whose page is already loaded (00h or 06h-E0h).
+// 00h with NFC_ROW_AUTO_INC reads sector_count sectors of following pages.
+// nfc_read_page_dma_start() only issues the read, nfc_read_page_dma_finish()
+// waits for it, so the CPU can work on the last page meanwhile.
+static void nfc_read_page_dma_start(int cmd1, int cmd2, int page_addr, int sector_count,
+									void *buf)
+{
+	uint32_t cfg = cmd1 | NFC_SEND_CMD1 | NFC_DATA_TRANS | NFC_DATA_SWAP_METHOD | (2 << 30);
+
+	cmd1 &= NFC_CMD_LOW_BYTE;
+	// 31h/3Fh has no address and data is out after tRCBSY
+	if (cmd1 == NAND_CMD_READ_CACHE_SEQ || cmd1 == NAND_CMD_READ_CACHE_END)
+		cfg |= NFC_WAIT_FLAG;
+	else
+		cfg |= NFC_SEND_ADR | ((5 - 1) << 16);
+	if (cmd2 >= 0)
+		cfg |= NFC_SEND_CMD2;
+	if (cmd2 == NAND_CMD_READSTART)
+		cfg |= NFC_WAIT_FLAG;
+
+	sunxi_nand_read_page_addr = page_addr;
+
+	wait_cmdfifo_free();
+
+	//access NFC internal RAM by DMA bus
+	set_ram_method(1);
+	dma_nand_config_start(dma_hdle, 0, (uint32_t)buf, sector_count * 1024);
+
+	writel_relaxed(page_addr << 16, NFC_REG_ADDR_LOW);
+	writel_relaxed((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	// RAM0 is 1K size, the count is per sector
+	writel_relaxed(1024, NFC_REG_CNT);
+	// 00h-addr-30h, then 05h-col-E0h for each sector
+	writel_relaxed(0x00e00500 | (cmd2 & 0xff), NFC_REG_RCMD_SET);
+	writel_relaxed(sector_count, NFC_REG_SECTOR_NUM);
+
+	xfer_begin(page_addr, 1);
+
+	send_cmd(cfg);
+}
+
+static void nfc_read_page_dma_finish(int sector_count, uint32_t *user_data)
+{
+	int i;
+
+	dma_nand_wait_finish();
+	if (!cmd_irq_on())
+		wait_cmdfifo_free();
+	wait_cmd_finish();
+
+	for (i = 0; i < sector_count; i++)
+		user_data[i] = readl_relaxed(NFC_REG_USER_DATA(i));
+
+	xfer_end();
+}
+
+static void nfc_read_page_dma(int cmd1, int cmd2, int page_addr, int sector_count,
+							  void *buf, uint32_t *user_data)
+{
+	nfc_read_page_dma_start(cmd1, cmd2, page_addr, sector_count, buf);
+	nfc_read_page_dma_finish(sector_count, user_data);
+}
+
+// 85h random data input to column
+static void change_write_column(int column)
+{
+	writel(column & 0xffff, NFC_REG_ADDR_LOW);
+	writel(0, NFC_REG_ADDR_HIGH);
+	run_cmd(NAND_CMD_RNDIN | NFC_SEND_CMD1 | NFC_SEND_ADR | ((2 - 1) << 16));
+}
+
+static void change_read_column(int column)
+{
+	writel(column & 0xffff, NFC_REG_ADDR_LOW);
+	writel(0, NFC_REG_ADDR_HIGH);
+	writel(NAND_CMD_RNDOUTSTART, NFC_REG_RCMD_SET);
+	run_cmd(NAND_CMD_RNDOUT | NFC_SEND_CMD1 | NFC_SEND_ADR | ((2 - 1) << 16) | NFC_SEND_CMD2);
+}
+
+// Program sector [first, end) of a page one by one without the page command,
+// sectors out of the range are left unprogrammed so that they can still be
+// programmed later (sub-page write). For each sector, the 1K data is written
+// through RAM0 with ECC enabled, then the ECC command (type 1) writes the user
+// data and ECC parity to the spare area of this sector. 10h is sent at last
+// and nfc_wait() will wait for the program finish.
+static void nfc_program_sectors(struct mtd_info *mtd, int page_addr, int first, int end,
+								const uint8_t *buf, const uint8_t *oob)
+{
+	int i, j, ecc_mode, column;
+
+	ecc_mode = (nfc_ecc_ctl & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
+
+	// 80h-addr with the column of the first sector
+	column = first * 1024;
+	writel((column & 0xffff) | (page_addr << 16), NFC_REG_ADDR_LOW);
+	writel((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	run_cmd(NAND_CMD_SEQIN | NFC_SEND_CMD1 | NFC_SEND_ADR | ((5 - 1) << 16));
+
+	enable_ecc(1);
+
+	for (i = first; i < end; i++) {
+		const uint32_t *data = (const uint32_t *)(buf + i * 1024);
+		int oob_column = phys_writesize + i * (4 + ecc_parity_bytes[ecc_mode]);
+
+		if (column != i * 1024)
+			change_write_column(i * 1024);
+		for (j = 0; j < 1024 / 4; j++)
+			writel(data[j], NFC_RAM0_BASE + j * 4);
+		writel(1024, NFC_REG_CNT);
+		run_cmd(NFC_DATA_TRANS | NFC_ACCESS_DIR);
+
+		change_write_column(oob_column);
+		writel(*((const uint32_t *)oob + i), NFC_REG_USER_DATA(0));
+		run_cmd(NFC_DATA_TRANS | NFC_DATA_SWAP_METHOD | NFC_ACCESS_DIR | (1 << 30));
+		column = oob_column + 4 + ecc_parity_bytes[ecc_mode];
+	}
+
+	disable_ecc();
+
+	run_cmd(NAND_CMD_PAGEPROG | NFC_SEND_CMD1);
+}
+
+// Read the first sector_count sectors of a page one by one by CPU, the
+// reverse of nfc_program_sectors(): for each sector the 1K data is read
+// to RAM0 with ECC enabled, then the ECC command (type 1) reads the user
+// data and ECC parity of this sector and corrects the data in RAM0.
+// Return ECC result like check_ecc().
+static int nfc_read_sectors_pio(int page_addr, int sector_count, uint8_t *buf,
+								uint32_t *user_data)
+{
+	int i, ecc_mode, column = 0;
+	struct ecc_snapshot snap;
+
+	ecc_mode = (nfc_ecc_ctl & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
+
+	// 00h-addr-30h
+	writel(page_addr << 16, NFC_REG_ADDR_LOW);
+	writel((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	writel(NAND_CMD_READSTART, NFC_REG_RCMD_SET);
+	run_cmd(NAND_CMD_READ0 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((5 - 1) << 16) |
+			NFC_SEND_CMD2 | NFC_WAIT_FLAG);
+
+	set_ram_method(0);
+	enable_ecc(1);
+
+	// the ECC state of each ECC command is of its sector 0
+	memset(&snap, 0, sizeof(snap));
+	snap.page = page_addr;
+	for (i = 0; i < sector_count; i++) {
+		int oob_column = phys_writesize + i * (4 + ecc_parity_bytes[ecc_mode]);
+
+		if (column != i * 1024)
+			change_read_column(i * 1024);
+		writel(1024, NFC_REG_CNT);
+		run_cmd(NFC_DATA_TRANS);
+
+		change_read_column(oob_column);
+		run_cmd(NFC_DATA_TRANS | NFC_DATA_SWAP_METHOD | (1 << 30));
+		snap.ecc_st |= (readl(NFC_REG_ECC_ST) & 1) << i;
+		snap.ecc_cnt[i / 4] |= (readl(NFC_REG_ECC_CNT0) & 0xff) << ((i & 3) * 8);
+		user_data[i] = readl(NFC_REG_USER_DATA(0));
+		ram0_read(buf + i * 1024, 1024);
+		column = oob_column + 4 + ecc_parity_bytes[ecc_mode];
+	}
+
+	disable_ecc();
+
+	return ecc_decode(&snap, 0, sector_count, buf, user_data);
+}
+
+// page program sector_count 1K sectors from column by DMA from buf:
+// cmd1-addr-data-cmd2 with 85h-col for each sector, cmd1 is 80h or 81h
+// (second plane), cmd2 is 10h, 11h (first plane, wait for tDBSY) or
+// 15h (cache program, wait for tCBSY)
+static void nfc_program_page_dma(int cmd1, int cmd2, int page_addr, int column, int sector_count,
+								 const void *buf, const uint8_t *user_data, int ecc)
+{
+	int i;
+	uint32_t cfg = cmd1 | NFC_SEND_CMD1 | NFC_DATA_TRANS | NFC_SEND_ADR | NFC_SEND_CMD2 | 
+		((5 - 1) << 16) | NFC_DATA_SWAP_METHOD | NFC_ACCESS_DIR | (2 << 30);
+
+	if (cmd2 != NAND_CMD_PAGEPROG)
+		cfg |= NFC_WAIT_FLAG;
+
+	wait_cmdfifo_free();
+
+	//access NFC internal RAM by DMA bus
+	set_ram_method(1);
+	dma_nand_config_start(dma_hdle, 1, (uint32_t)buf, sector_count * 1024);
+
+	writel_relaxed((column & 0xffff) | (page_addr << 16), NFC_REG_ADDR_LOW);
+	writel_relaxed((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	// RAM0 is 1K size
+	writel_relaxed(1024, NFC_REG_CNT);
+	writel_relaxed(0x00008500 | cmd2, NFC_REG_WCMD_SET);
+	writel_relaxed(sector_count, NFC_REG_SECTOR_NUM);
+	if (user_data) {
+		for (i = 0; i < sector_count; i++)
+			writel_relaxed(*((const uint32_t *)user_data + i), NFC_REG_USER_DATA(i));
+	}
+
+	xfer_begin(page_addr, ecc);
+
+	send_cmd(cfg);
+
+	dma_nand_wait_finish();
+	if (!cmd_irq_on())
+		wait_cmdfifo_free();
+	wait_cmd_finish();
+
+	xfer_end();
+}
+
+// page of a plane for a MTD page
+static inline int plane_page(int page, int plane)
+{
+	int mask = (1 << block_page_shift) - 1;
+
+	if (plane_num == 1)
+		return page;
+	return ((((page >> block_page_shift) * 2 + plane) << block_page_shift) | (page & mask));
+}
+
+// 5 address cycles for row only commands of ONFI
+static inline void set_row_addr(int page_addr, int addr_cycle)
+{
+	if (addr_cycle == 5) {
+		writel(page_addr << 16, NFC_REG_ADDR_LOW);
+		writel((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	}
+	else {
+		writel(page_addr & 0xffffff, NFC_REG_ADDR_LOW);
+		writel(0, NFC_REG_ADDR_HIGH);
+	}
+}
+
+// load a page of both planes to their page registers at once
+static void nfc_load_two_plane(int page0, int page1)
+{
+	if (onfi_plane_cmd) {
+		// 00h-addr-32h, 00h-addr-30h
+		set_row_addr(page0, 5);
+		writel(NAND_CMD_MULTI_PLANE_READ, NFC_REG_RCMD_SET);
+		run_cmd(NAND_CMD_READ0 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((5 - 1) << 16) |
+				NFC_SEND_CMD2 | NFC_WAIT_FLAG);
+		set_row_addr(page1, 5);
+		writel(NAND_CMD_READSTART, NFC_REG_RCMD_SET);
+		run_cmd(NAND_CMD_READ0 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((5 - 1) << 16) |
+				NFC_SEND_CMD2 | NFC_WAIT_FLAG);
+	}
+	else {
+		// 60h-row-60h-row-30h
+		set_row_addr(page0, 3);
+		run_cmd(NAND_CMD_ERASE1 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((3 - 1) << 16));
+		set_row_addr(page1, 3);
+		writel(NAND_CMD_READSTART, NFC_REG_RCMD_SET);
+		run_cmd(NAND_CMD_ERASE1 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((3 - 1) << 16) |
+				NFC_SEND_CMD2 | NFC_WAIT_FLAG);
+	}
+}
+
+// Sequential pages are read by cache read: 31h moves the page in page
+// register to cache register and starts loading the next page, so the
+// DMA of this page runs in parallel with the tR of the next page. A page
+// not following the last one restarts with 00h-30h. Cache read doesn't
+// cross block boundary, 3Fh is used for the last page of a block.
+static void nfc_read_page_cached(int page, int sector_count, void *buf, uint32_t *user_data)
+{
+	int last = ((page + 1) & ((1 << block_page_shift) - 1)) == 0;
+
+	if (page == cache_read_page) {
+		cache_read_count++;
+	}
+	else {
+		nfc_cache_read_end();
+		// no next page to load
+		if (last) {
+			nfc_read_page_dma(NAND_CMD_READ0, NAND_CMD_READSTART, page, sector_count, buf, user_data);
+			return;
+		}
+		// 00h-addr-30h
+		set_row_addr(page, 5);
+		writel(NAND_CMD_READSTART, NFC_REG_RCMD_SET);
+		run_cmd(NAND_CMD_READ0 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((5 - 1) << 16) |
+				NFC_SEND_CMD2 | NFC_WAIT_FLAG);
+	}
+
+	nfc_read_page_dma(last ? NAND_CMD_READ_CACHE_END : NAND_CMD_READ_CACHE_SEQ, -1, 
+					  page, sector_count, buf, user_data);
+	cache_read_page = last ? -1 : page + 1;
+}
+
+// ECC result of a page from the ones of its parts
+static inline int merge_ecc_stat(int ret, int stat)
+{
+	return (ret < 0 || stat < 0) ? -1 : ret + stat;
+}
+
+// read the first sector_count sectors of a page of the selected chip to
+// buf and their user data to user_data, return ECC result like
+// check_ecc(), two planes are always read whole
+static int nfc_read_planes(int page, int sector_count, uint8_t *buf, uint32_t *user_data)
+{
+	int p, ret = 0;
+
+	if (plane_num == 1) {
+		// short reads by CPU, random seed is per page
+		if (sector_count * 1024 <= pio_threshold && hwecc_switch && !random_switch) {
+			if (cache_read_on)
+				nfc_cache_read_end();
+			return nfc_read_sectors_pio(page, sector_count, buf, user_data);
+		}
+		if (cache_read_on)
+			nfc_read_page_cached(page, sector_count, buf, user_data);
+		else
+			nfc_read_page_dma(NAND_CMD_READ0, NAND_CMD_READSTART, page, sector_count, buf, user_data);
+		return hwecc_switch ? check_ecc_read(sector_count, buf, user_data) : 0;
+	}
+
+	nfc_load_two_plane(plane_page(page, 0), plane_page(page, 1));
+	for (p = 0; p < plane_num; p++) {
+		if (onfi_plane_cmd)
+			nfc_read_page_dma(NAND_CMD_RNDOUT_PLANE, NAND_CMD_RNDOUTSTART, plane_page(page, p), 
+							  sector_count, buf + p * phys_writesize, user_data + p * sector_count);
+		else
+			nfc_read_page_dma(NAND_CMD_READ0, -1, plane_page(page, p), 
+							  sector_count, buf + p * phys_writesize, user_data + p * sector_count);
+		// ECC state is of the last command
+		if (hwecc_switch)
+			ret = merge_ecc_stat(ret, check_ecc_read(sector_count, buf + p * phys_writesize,
+													 user_data + p * sector_count));
+	}
+	return ret;
+}
+
+// program a MTD page, the first plane is programmed with 11h and the
+// last one with prog_cmd (10h or 15h), nfc_wait() waits for all of them
+static void nfc_program_planes(int page, const uint8_t *buf, const uint8_t *oob, int ecc,
+							   int prog_cmd)
+{
+	int p, sector_count = phys_writesize / 1024;
+
+	for (p = 0; p < plane_num; p++) {
+		int cmd1 = NAND_CMD_SEQIN, cmd2 = prog_cmd;
+
+		if (p < plane_num - 1)
+			cmd2 = NAND_CMD_MULTI_PLANE_PROG;
+		// Samsung/Hynix use 81h for the second plane
+		if (p > 0 && !onfi_plane_cmd)
+			cmd1 = 0x81;
+		nfc_program_page_dma(cmd1, cmd2, plane_page(page, p), 0, sector_count, 
+							 buf + p * phys_writesize, oob + p * sector_count * 4, ecc);
+	}
+}
+
+// read 1K raw data from column of spare area without ECC
+static void nfc_read_spare_dma(int page_addr, int column, void *buf)
+{
+	uint32_t cfg = NAND_CMD_READ0 | NFC_SEND_CMD1 | NFC_DATA_TRANS | NFC_SEND_ADR | 
+		NFC_SEND_CMD2 | ((5 - 1) << 16) | NFC_WAIT_FLAG | NFC_DATA_SWAP_METHOD | (2 << 30);
+
+	wait_cmdfifo_free();
+
+	//access NFC internal RAM by DMA bus
+	set_ram_method(1);
+	// if the size is smaller than NFC_REG_SECTOR_NUM, read command won't finish
+	// does that means the data read out (by DMA through random data output) hasn't finish?
+	dma_nand_config_start(dma_hdle, 0, (uint32_t)buf, 1024);
+
+	column += phys_writesize;
+	writel((column & 0xffff) | (page_addr << 16), NFC_REG_ADDR_LOW);
+	writel((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	// RAM0 is 1K size
+	writel(1024, NFC_REG_CNT);
+	// 0x30 for 2nd cycle of read page
+	// 0x05+0xe0 is the random data output command
+	writel(0x00e00530, NFC_REG_RCMD_SET);
+	writel(1, NFC_REG_SECTOR_NUM);
+
+	if (random_switch)
+		enable_random(page_addr);
+
+	send_cmd(cfg);
+
+	dma_nand_wait_finish();
+	if (!cmd_irq_on())
+		wait_cmdfifo_free();
+	wait_cmd_finish();
+
+	if (random_switch)
+		disable_random();
+}
+
+// read a MTD page, chips are read one by one and always whole
+static int nfc_read_chips(int page, int sector_count, uint8_t *buf, uint32_t *user_data)
+{
+	int w, ret = 0, size = plane_num * phys_writesize;
+
+	if (way_num == 1)
+		return nfc_read_planes(page, sector_count, buf, user_data);
+
+	for (w = 0; w < way_num; w++) {
+		select_chip(w);
+		ret = merge_ecc_stat(ret, nfc_read_planes(page, sector_count, buf + w * size,
+												  user_data + w * size / 1024));
+	}
+	select_chip(0);
+	return ret;
+}
+
+// program a MTD page, the data of next chip is transferred while the
+// previous one is programming, nfc_wait() waits for all of them
+static void nfc_program_chips(int page, const uint8_t *buf, const uint8_t *oob, int ecc,
+							  int prog_cmd)
+{
+	int w, size = plane_num * phys_writesize;
+
+	for (w = 0; w < way_num; w++) {
+		if (way_num > 1)
+			select_chip(w);
+		nfc_program_planes(page, buf + w * size, oob + w * size / 1024 * 4, ecc, prog_cmd);
+	}
+}
+
+// 4 bytes user data of each sector to the spare area by random data
+// input, where a page program puts them, no ECC. 10h is sent at last.
+static void nfc_program_user_data(int page_addr, const uint8_t *oob)
+{
+	int i, sector_count = phys_writesize / 1024;
+	int ecc_mode = (nfc_ecc_ctl & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
+	int column = phys_writesize;
+
+	// 80h-addr with the column of the first sector's user data
+	set_ram_method(0);
+	writel((column & 0xffff) | (page_addr << 16), NFC_REG_ADDR_LOW);
+	writel((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	run_cmd(NAND_CMD_SEQIN | NFC_SEND_CMD1 | NFC_SEND_ADR | ((5 - 1) << 16));
+
+	// 85h-col-4 bytes through RAM0 for each sector
+	for (i = 0; i < sector_count; i++) {
+		if (i > 0)
+			change_write_column(column);
+		writel(*((const uint32_t *)oob + i), NFC_RAM0_BASE);
+		writel(4, NFC_REG_CNT);
+		run_cmd(NFC_DATA_TRANS | NFC_ACCESS_DIR);
+		column += 4 + ecc_parity_bytes[ecc_mode];
+	}
+
+	run_cmd(NAND_CMD_PAGEPROG | NFC_SEND_CMD1);
+}
+
+// program spare area of all planes and chips from write_buffer without
+// ECC, laid out as nfc_read_oob() reads it
+static void nfc_program_oob(int page)
+{
+	int w, p;
+	// user data of all units back to back like a page read
+	int unit_size = phys_writesize / 1024 * 4;
+
+	for (w = 0; w < way_num; w++) {
+		if (way_num > 1)
+			select_chip(w);
+		for (p = 0; p < plane_num; p++) {
+			if (p > 0)
+				wait_rb_ready(chip_rb(w));
+			if (hwecc_switch && !random_switch)
+				nfc_program_user_data(plane_page(page, p),
+									  write_buffer + (w * plane_num + p) * unit_size);
+			else
+				nfc_program_page_dma(NAND_CMD_SEQIN, NAND_CMD_PAGEPROG, plane_page(page, p),
+									 phys_writesize, 1,
+									 write_buffer + (w * plane_num + p) * phys_oobsize, NULL, 0);
+		}
+	}
+}
+
+// 4 bytes user data of each sector from the spare area by random data
+// output, packed as a page read gives, no ECC check
+static void nfc_read_user_data(int page_addr, uint8_t *oob)
+{
+	int i, sector_count = phys_writesize / 1024;
+	int ecc_mode = (nfc_ecc_ctl & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
+	int column = phys_writesize;
+
+	// 00h-addr-30h
+	writel((column & 0xffff) | (page_addr << 16), NFC_REG_ADDR_LOW);
+	writel((page_addr >> 16) & 0xff, NFC_REG_ADDR_HIGH);
+	writel(NAND_CMD_READSTART, NFC_REG_RCMD_SET);
+	run_cmd(NAND_CMD_READ0 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((5 - 1) << 16) |
+			NFC_SEND_CMD2 | NFC_WAIT_FLAG);
+
+	// 05h-col-E0h-4 bytes through RAM0 for each sector
+	set_ram_method(0);
+	writel(NAND_CMD_RNDOUTSTART, NFC_REG_RCMD_SET);
+	writel(4, NFC_REG_CNT);
+	for (i = 0; i < sector_count; i++) {
+		writel(column & 0xffff, NFC_REG_ADDR_LOW);
+		run_cmd(NAND_CMD_RNDOUT | NFC_SEND_CMD1 | NFC_SEND_ADR | ((2 - 1) << 16) |
+				NFC_SEQ | NFC_SEND_CMD2 | NFC_DATA_TRANS);
+		ram0_read(oob + i * 4, 4);
+		column += 4 + ecc_parity_bytes[ecc_mode];
+	}
+}
+
+// the same user data picked out of one raw 1K spare read, the user data
+// and parity of all sectors must fit in it
+static void nfc_read_user_data_dma(int page_addr, uint8_t *oob)
+{
+	int i, sector_count = phys_writesize / 1024;
+	int ecc_mode = (nfc_ecc_ctl & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
+	int step = 4 + ecc_parity_bytes[ecc_mode];
+	// read_buffer has 1K at least after the MTD page
+	uint8_t *spare = read_buffer + plane_num * way_num * phys_writesize;
+
+	nfc_read_spare_dma(page_addr, 0, spare);
+	for (i = 0; i < sector_count; i++)
+		memcpy(oob + i * 4, spare + i * step, 4);
+}
+
+// read spare area of all planes and chips from column to read_buffer
+static void nfc_read_oob(int page, int column)
+{
+	int w, p, i, units = way_num * plane_num;
+
+	// randomized spare can only be read as a whole
+	if (hwecc_switch && !random_switch) {
+		// user data of all units back to back like a page read
+		int unit_size = phys_writesize / 1024 * 4;
+		int ecc_mode = (nfc_ecc_ctl & NFC_ECC_MODE) >> NFC_ECC_MODE_SHIFT;
+		int dma = oob_dma_switch &&
+			phys_writesize / 1024 * (4 + ecc_parity_bytes[ecc_mode]) <= 1024;
+
+		for (w = 0; w < way_num; w++) {
+			if (way_num > 1)
+				select_chip(w);
+			for (p = 0; p < plane_num; p++) {
+				uint8_t *oob = read_buffer + (w * plane_num + p) * unit_size;
+
+				if (dma)
+					nfc_read_user_data_dma(plane_page(page, p), oob);
+				else
+					nfc_read_user_data(plane_page(page, p), oob);
+			}
+		}
+		if (way_num > 1)
+			select_chip(0);
+		memset(read_buffer + units * unit_size, 0xff, units * (phys_oobsize - unit_size));
+
+		// the MTD block is bad if any block of it is bad
+		for (i = 1; i < units; i++)
+			read_buffer[0] &= read_buffer[i * unit_size];
+		if (column)
+			memmove(read_buffer, read_buffer + column, units * phys_oobsize - column);
+		return;
+	}
+
+	for (w = 0; w < way_num; w++) {
+		if (way_num > 1)
+			select_chip(w);
+		for (p = 0; p < plane_num; p++) {
+			i = w * plane_num + p;
+			nfc_read_spare_dma(plane_page(page, p), column, read_buffer + i * 1024);
+		}
+	}
+	if (way_num > 1)
+		select_chip(0);
+
+	for (i = 1; i < units; i++) {
+		// the MTD block is bad if any block of it is bad
+		if (column == 0)
+			read_buffer[0] &= read_buffer[i * 1024];
+		memmove(read_buffer + i * phys_oobsize, read_buffer + i * 1024, phys_oobsize);
+	}
+}
+
+// start erasing a MTD block on all planes and chips, nfc_wait() waits for
+// all of them
+static void nfc_erase_chips(int page)
+{
+	int w;
+
+	for (w = 0; w < way_num; w++) {
+		if (way_num > 1)
+			select_chip(w);
+		if (plane_num > 1) {
+			// Samsung/Hynix 60h-row-60h-row-D0h, ONFI 60h-row-D1h-60h-row-D0h
+			set_row_addr(plane_page(page, 0), 3);
+			queue_cmd(NAND_CMD_ERASE1 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((3 - 1) << 16));
+			if (onfi_plane_cmd)
+				queue_cmd(NAND_CMD_MULTI_PLANE_ERASE | NFC_SEND_CMD1 | NFC_WAIT_FLAG);
+			// the next row address can only be set after this batch
+			wait_cmds_finish();
+		}
+		set_row_addr(plane_page(page, plane_num - 1), 3);
+		queue_cmd(NAND_CMD_ERASE1 | NFC_SEND_CMD1 | NFC_SEND_ADR | ((3 - 1) << 16));
+		queue_cmd(NAND_CMD_ERASE2 | NFC_SEND_CMD1);
+		wait_cmds_finish();
+	}
+}
+
+// sectors [first, end) of a page the sub-page write in progress covers,
+// 0 when the page is programmed whole
+static int nfc_subpage_range(struct mtd_info *mtd, int page, int *first, int *end)
+{
+	struct nand_chip *chip = mtd->priv;
+	struct subpage_write *sw = &subpage;
+	int sectors = mtd->writesize / 1024;
+
+	if (sw->task != current)
+		return 0;
+
+	*first = 0;
+	*end = sectors;
+	if (page == ((sw->start >> chip->page_shift) & chip->pagemask))
+		*first = (sw->start & (mtd->writesize - 1)) / 1024;
+	if (page == (((sw->end - 1) >> chip->page_shift) & chip->pagemask))
+		*end = ((sw->end - 1) & (mtd->writesize - 1)) / 1024 + 1;
+	return *first != 0 || *end != sectors;
+}
+
+static void nfc_do_cmdfunc(struct mtd_info *mtd, unsigned command, int column,
+						   int page_addr)
+{
+	uint32_t cfg = command;
+	int write_size, first, end;
+	int addr_cycle, wait_rb_flag, byte_count;
+	addr_cycle = wait_rb_flag = byte_count = 0;
+
+	//DBG_INFO("command %x ...\n", command);
+	read_page_pending = 0;
+	// READ0 only records the page which may be the next of cache read
+	if (command != NAND_CMD_READ0)
+		nfc_cache_read_end();
+	// only the next page program can follow cache program
+	if (command != NAND_CMD_SEQIN && command != NAND_CMD_PAGEPROG &&
+		command != NAND_CMD_CACHEDPROG && command != NAND_CMD_STATUS)
+		nfc_cache_prog_end();
+	wait_cmdfifo_free();
+
+	// switch to AHB
+	set_ram_method(0);
+
+	switch (command) {
+	case NAND_CMD_RESET:
+		break;
+	case NAND_CMD_READID:
+		addr_cycle = 1;
+		// read 8 byte ID
+		byte_count = 8;
+		break;
 	case NAND_CMD_PARAM:
 		addr_cycle = 1;
 		byte_count = 1024;
@@ -428,92 +1821,73 @@ static void nfc_cmdfunc(struct mtd_info *mtd, unsigned command, int column,
 		cfg |= NFC_SEQ | NFC_SEND_CMD2;
 		wait_rb_flag = 1;
 		break;
-	case NAND_CMD_READOOB:
 	case NAND_CMD_READ0:
-		if (command == NAND_CMD_READOOB) {
-			cfg = NAND_CMD_READ0;
-			// sector num to read
-			sector_count = 1024 / 1024;
-			read_size = 1024;
-			// OOB offset
-			column += mtd->writesize;
-		}
-		else {
-			sector_count = mtd->writesize / 1024;
-			read_size = mtd->writesize;
-			do_enable_ecc = 1;
-			sunxi_nand_read_page_addr = page_addr;
-			//DBG_INFO("cmdfunc read %d %d\n", column, page_addr);
-		}
-		do_enable_random = 1;
-			
-		//access NFC internal RAM by DMA bus
-		writel(readl(NFC_REG_CTL) | NFC_RAM_METHOD, NFC_REG_CTL);
-		// if the size is smaller than NFC_REG_SECTOR_NUM, read command won't finish
-		// does that means the data read out (by DMA through random data output) hasn't finish?
-		dma_nand_config_start(dma_hdle, 0, (uint32_t)read_buffer, read_size);
-		addr_cycle = 5;
-		// RAM0 is 1K size
-		byte_count =1024;
-		wait_rb_flag = 1;
-		// 0x30 for 2nd cycle of read page
-		// 0x05+0xe0 is the random data output command
-		writel(0x00e00530, NFC_REG_RCMD_SET);
-		// NFC_SEND_CMD1 for the command 1nd cycle enable
-		// NFC_SEND_CMD2 for the command 2nd cycle enable
-		// NFC_SEND_CMD3 & NFC_SEND_CMD4 for NFC_READ_CMD0 & NFC_READ_CMD1
-		cfg |= NFC_SEND_CMD2 | NFC_DATA_SWAP_METHOD;
-		// 3 - ?
-		// 2 - page command
-		// 1 - spare command?
-		// 0 - normal command
-		cfg |= 2 << 30;
-		break;
+		// page data is transferred later by nfc_read_page() directly
+		// into the caller buffer or by nfc_read_buf() through read_buffer
+		read_page_addr = page_addr;
+		read_page_pending = 1;
+		read_data = read_buffer;
+		read_data_size = buffer_size;
+		read_offset = 0;
+		return;
+	case NAND_CMD_READOOB:
+		nfc_read_oob(page_addr, column);
+		read_data = read_buffer;
+		read_data_size = buffer_size;
+		read_offset = 0;
+		return;
 	case NAND_CMD_ERASE1:
-		addr_cycle = 3;
+		// erase is started by ERASE2 on all planes and chips
+		erase_page = page_addr;
 		//DBG_INFO("cmdfunc earse block %d\n", page_addr);
-		break;
+		return;
+	case NAND_CMD_ERASE2:
+		nfc_erase_chips(erase_page);
+		return;
 	case NAND_CMD_SEQIN:	
 		program_column = column;
 		program_page = page_addr;
+		program_buf = NULL;
 		write_offset = 0;
 		return;
+	case NAND_CMD_CACHEDPROG:
 	case NAND_CMD_PAGEPROG:
-		cfg = NAND_CMD_SEQIN;
-		addr_cycle = 5;
 		column = program_column;
 		page_addr = program_page;
 		// for write OOB
 		if (column == mtd->writesize) {
-			sector_count = 1024 /1024;
-			write_size = 1024;
+			nfc_program_oob(page_addr);
+			DBG_INFO("cmdfunc program %d %d with %x %x %x\n", column, page_addr, 
+					 write_buffer[0], write_buffer[1], write_buffer[2]);
 		}
 		else if (column == 0) {
-			sector_count = mtd->writesize / 1024;
-			do_enable_ecc = 1;
 			write_size = mtd->writesize;
-			for (i = 0; i < sector_count; i++)
-				writel(*((unsigned int *)(write_buffer + mtd->writesize) + i), NFC_REG_USER_DATA(i));
+			// data not from nfc_write_page(), but nfc_write_buf()
+			if (program_buf == NULL) {
+				program_buf = write_buffer;
+				program_oob = write_buffer + mtd->writesize;
+			}
+			else if (!dma_able(program_buf, write_size)) {
+				write_bounce_count++;
+				memcpy(write_buffer, program_buf, write_size);
+				program_buf = write_buffer;
+			}
+			// sub-page program, only the sectors nand_base writes
+			if (nfc_subpage_range(mtd, page_addr, &first, &end)) {
+				nfc_program_sectors(mtd, page_addr, first, end, program_buf, program_oob);
+				cache_prog_pending = 0;
+				program_buf = NULL;
+				return;
+			}
+			nfc_program_chips(page_addr, program_buf, program_oob, 1, command);
+			// 10h waits for all pages programmed to array
+			cache_prog_pending = command == NAND_CMD_CACHEDPROG;
+			program_buf = NULL;
 		}
 		else {
 			ERR_INFO("program unsupported column %d %d\n", column, page_addr);
-			return;
-		}
-		do_enable_random = 1;
-
-		//access NFC internal RAM by DMA bus
-		writel(readl(NFC_REG_CTL) | NFC_RAM_METHOD, NFC_REG_CTL);
-		dma_nand_config_start(dma_hdle, 1, (uint32_t)write_buffer, write_size);
-		// RAM0 is 1K size
-		byte_count =1024;
-		writel(0x00008510, NFC_REG_WCMD_SET);
-		cfg |= NFC_SEND_CMD2 | NFC_DATA_SWAP_METHOD | NFC_ACCESS_DIR;
-		cfg |= 2 << 30;
-		if (column != 0) {
-			DBG_INFO("cmdfunc program %d %d with %x %x %x\n", column, page_addr, 
-					 write_buffer[0], write_buffer[1], write_buffer[2]);
 		}
-		break;
+		return;
 	case NAND_CMD_STATUS:
 		byte_count = 1;
 		break;
@@ -527,6 +1901,9 @@ static void nfc_cmdfunc(struct mtd_info *mtd, unsigned command, int column,
 		uint32_t low = 0;
 		uint32_t high = 0;
 		switch (addr_cycle) {
+		case 1:
+			low = column & 0xff;
+			break;
 		case 2:
 			low = column & 0xffff;
 			break;
@@ -555,74 +1932,128 @@ static void nfc_cmdfunc(struct mtd_info *mtd, unsigned command, int column,
 		writel(byte_count, NFC_REG_CNT);
 	}
 
-	// set sectors
-	if (sector_count)
-		writel(sector_count, NFC_REG_SECTOR_NUM);
-
-	// enable random
-	if (random_switch && do_enable_random)
-		enable_random(page_addr);
-
-	// enable ecc
-	if (hwecc_switch && do_enable_ecc)
-		enable_ecc(1);
-
 	// send command
 	cfg |= NFC_SEND_CMD1;
-	writel(cfg, NFC_REG_CMD);
-
-	switch (command) {
-	case NAND_CMD_READ0:
-	case NAND_CMD_READOOB:
-	case NAND_CMD_PAGEPROG:
-		dma_nand_wait_finish();
-		break;
-	}
+	send_cmd(cfg);
 
 	// wait command send complete
-	wait_cmdfifo_free();
+	if (!cmd_irq_on())
+		wait_cmdfifo_free();
 	wait_cmd_finish();
 
+	if (byte_count) {
+		read_data_size = min(byte_count, (int)sizeof(cmd_data));
+		ram0_read(cmd_data, read_data_size);
+		read_data = cmd_data;
+	}
+
 	// reset will wait for RB ready
 	switch (command) {
 	case NAND_CMD_RESET:
+		if (cmd_irq_on()) {
+			wait_rb_ready(0);
+			wait_rb_ready(1);
+			select_rb(chip_rb(cur_chip));
+			break;
+		}
 		// wait rb0 ready
 		select_rb(0);
 		while (!check_rb_ready(0));
 		// wait rb1 ready
 		select_rb(1);
 		while (!check_rb_ready(1));
-		// select rb 0 back
-		select_rb(0);
-		break;
-	case NAND_CMD_READ0:
-		for (i = 0; i < sector_count; i++)
-			*((unsigned int *)(read_buffer + mtd->writesize) + i) = readl(NFC_REG_USER_DATA(i));
+		// select rb of the chip back
+		select_rb(chip_rb(cur_chip));
 		break;
 	}
 
-	// disable ecc
-	if (hwecc_switch && do_enable_ecc)
-		disable_ecc();
-
-	// disable random
-	if (random_switch && do_enable_random)
-		disable_random();
-
 	//DBG_INFO("done\n");
 
 	// read write offset
 	read_offset = 0;
 }
 
+// wait for all chips of the MTD page ready and get the status, fail if
+// any chip fails, chip 0 is left selected. With command interrupt,
+// program is waited by the status command itself, otherwise and for
+// erase it sleeps on B2R interrupt.
+static int wait_chips_status(int program)
+{
+	int w, status = 0, fail = 0;
+
+	program = program && cmd_irq_on();
+
+	if (way_num == 1) {
+		if (program)
+			return wait_read_status();
+		wait_rb_ready(chip_rb(cur_chip));
+		return read_status();
+	}
+
+	for (w = way_num - 1; w >= 0; w--) {
+		select_chip(w);
+		if (program)
+			status = wait_read_status();
+		else {
+			wait_rb_ready(chip_rb(w));
+			status = read_status();
+		}
+		fail |= status & (NAND_STATUS_FAIL | NAND_STATUS_FAIL_N1);
+	}
+	return status | fail;
+}
+
+static void nfc_cmdfunc_op(struct nfc_op *op)
+{
+	nfc_do_cmdfunc(op->mtd, op->command, op->column, op->page);
+
+	// program and erase ops finish with the chip ready, so that other
+	// ops can be run before nfc_wait()
+	switch (op->command) {
+	case NAND_CMD_PAGEPROG:
+	case NAND_CMD_CACHEDPROG:
+		prog_status = wait_chips_status(1);
+		break;
+	case NAND_CMD_ERASE2:
+		prog_status = wait_chips_status(0);
+		break;
+	}
+}
+
+static void nfc_cmdfunc(struct mtd_info *mtd, unsigned command, int column,
+						int page_addr)
+{
+	struct nfc_op op = { .run = nfc_cmdfunc_op, .mtd = mtd, .command = command,
+						 .column = column, .page = page_addr };
+
+	nfc_op_run(&op);
+}
+
+// op->len is the sector number of a plane page
+static void nfc_read_page_op(struct nfc_op *op)
+{
+	op->result = nfc_read_chips(op->page, op->len, op->buf, op->oob);
+}
+
+// read the first sectors of a MTD page under the NFC lock, return ECC result
+// like check_ecc()
+static int nfc_read_page_sync(struct mtd_info *mtd, int page, int sectors, uint8_t *buf,
+							  uint32_t *user_data)
+{
+	struct nfc_op op = { .run = nfc_read_page_op, .mtd = mtd, .command = NAND_CMD_READ0,
+						 .page = page, .len = sectors, .buf = buf, .oob = user_data };
+
+	return nfc_op_run(&op);
+}
+
 static uint8_t nfc_read_byte(struct mtd_info *mtd)
 {
-	return readb(NFC_RAM0_BASE + read_offset++);
+	return read_data[read_offset++];
 }
 
 static int nfc_dev_ready(struct mtd_info *mtd)
 {
-	return check_rb_ready(0);
+	return check_rb_ready(chip_rb(cur_chip));
 }
 
 static void nfc_write_buf(struct mtd_info *mtd, const uint8_t *buf, int len)
@@ -638,23 +2069,32 @@ static void nfc_write_buf(struct mtd_info *mtd, const uint8_t *buf, int len)
 
 static void nfc_read_buf(struct mtd_info *mtd, uint8_t *buf, int len)
 {
-	if (read_offset + len > buffer_size) {
+	if (read_page_pending) {
+		nfc_read_page_sync(mtd, read_page_addr, phys_writesize / 1024, read_buffer,
+						   (uint32_t *)(read_buffer + mtd->writesize));
+		read_page_pending = 0;
+	}
+
+	if (read_offset + len > read_data_size) {
 		ERR_INFO("read too much offset=%d len=%d buffer size=%d\n", 
-				 read_offset, len, buffer_size);
+				 read_offset, len, read_data_size);
 		return;
 	}
-	memcpy(buf, read_buffer + read_offset, len);
+	memcpy(buf, read_data + read_offset, len);
 	read_offset += len;
 }
 
 static irqreturn_t nfc_interrupt_handler(int irq, void *dev_id)
 {
 	unsigned int st = readl(NFC_REG_ST);
+	// clear interrupt before waking up, wait_cmds_finish() checks the flag
+	writel(st, NFC_REG_ST);
 	if (st & NFC_RB_B2R) {
 		wake_up(&nand_rb_wait);
 	}
 	if (st & NFC_CMD_INT_FLAG) {
-		DBG_INFO("CMD INT\n");
+		nand_cmd_done = 1;
+		wake_up(&nand_cmd_wait);
 	}
 	if (st & NFC_DMA_INT_FLAG) {
 		//DBG_INFO("DMA INT\n");
@@ -662,38 +2102,26 @@ static irqreturn_t nfc_interrupt_handler(int irq, void *dev_id)
 	if (st & NFC_NATCH_INT_FLAG) {
 		DBG_INFO("NATCH INT\n");
 	}
-	// clear interrupt
-	writel(st, NFC_REG_ST);
 	return IRQ_HANDLED;
 }
 
-static int get_chip_status(struct mtd_info *mtd)
+static void nfc_wait_op(struct nfc_op *op)
 {
-	nfc_cmdfunc(mtd, NAND_CMD_STATUS, -1, -1);
-	return nfc_read_byte(mtd);
+	op->result = wait_chips_status(0);
 }
 
-// For erase and program command to wait for chip ready
+// For erase and program command to wait for chip ready, which is done
+// by their ops already
 static int nfc_wait(struct mtd_info *mtd, struct nand_chip *chip)
 {
-	int err;
-
-	// clear B2R interrupt state
-	writel(NFC_RB_B2R, NFC_REG_ST);
-
-	if (check_rb_ready(0))
-		goto out;
+	struct nfc_op op = { .run = nfc_wait_op, .mtd = mtd, .command = NAND_CMD_STATUS };
+	int status = prog_status;
 
-	// enable B2R interrupt
-	writel(NFC_B2R_INT_ENABLE, NFC_REG_INT);
-	if ((err = wait_event_timeout(nand_rb_wait, check_rb_ready(0), 1*HZ)) < 0) {
-		DBG_INFO("nfc wait got exception %d\n", err);
+	if (status >= 0) {
+		prog_status = -1;
+		return status;
 	}
-	// disable interrupt
-	writel(0, NFC_REG_INT);
-
-out:
-	return get_chip_status(mtd);
+	return nfc_op_run(&op);
 }
 
 static void nfc_ecc_hwctl(struct mtd_info *mtd, int mode)
@@ -714,6 +2142,364 @@ static int nfc_ecc_correct(struct mtd_info *mtd, uint8_t *dat, uint8_t *read_ecc
 	return check_ecc(mtd->writesize / 1024);
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Multi-page read
+//
+// mtd->_read is wrapped to tell nfc_read_page() which caller buffer a
+// page aligned read goes to. nand_base still gets the device and asks
+// for the pages one by one, but a page not read ahead is read together
+// with the following pages of the request: a run of pages by one
+// 00h-addr-30h command with row auto increment and one DMA. The ECC state
+// of all sectors of a run must fit in NFC_REG_ECC_ST, so a run is at most
+// 16 sectors and pages larger than 8K are not read this way. An op reads
+// up to MULTIPAGE_MAX_RUNS runs: the ECC registers of a run are copied
+// and the next run is started before they are decoded to a result per
+// page. A page with an uncorrectable sector is read again alone.
+//
+// The same wrapper marks the last page of an unaligned read, which
+// nand_base reads to its own buffer: only its sectors 0..last covering
+// the read are transferred. The page command places each sector and its
+// user data and parity by the index from sector 0, so the sectors in
+// front of the read can't be skipped. nand_base would keep the page as
+// its page cache, nfc_select_chip() drops that when nand_base deselects
+// the chip before releasing the device.
+
+#define MULTIPAGE_MAX_SECTORS 16
+#define MULTIPAGE_MAX_RUNS 4
+#define MULTIPAGE_MAX_PAGES (MULTIPAGE_MAX_SECTORS * MULTIPAGE_MAX_RUNS)
+
+// the multi-page read in progress, protected by multipage_lock
+static struct multipage_read {
+	struct task_struct *task;
+	// caller buffer, first page and page number of the request
+	uint8_t *buf;
+	int page, pages;
+	// pages [first, first + count) of the request are read ahead
+	int first, count;
+	int run_pages;
+	// ECC result of each page like check_ecc() and its user data
+	int result[MULTIPAGE_MAX_PAGES];
+	uint32_t user_data[MULTIPAGE_MAX_SECTORS * MULTIPAGE_MAX_RUNS];
+} multipage;
+
+static DEFINE_MUTEX(multipage_lock);
+static int multipage_on = 0;
+
+static int (*nand_base_read)(struct mtd_info *mtd, loff_t from, size_t len,
+							 size_t *retlen, u_char *buf);
+
+static void nfc_read_run_start(struct nfc_op *op, int first, int pages)
+{
+	nfc_read_page_dma_start(NAND_CMD_READ0 | NFC_ROW_AUTO_INC, NAND_CMD_READSTART,
+							op->page + first, pages * (phys_writesize / 1024),
+							(uint8_t *)op->buf + first * op->mtd->writesize);
+}
+
+// op->len is the page number, op->oob the user data of all pages
+static void nfc_read_pages_op(struct nfc_op *op)
+{
+	struct ecc_snapshot snap;
+	uint32_t *user_data = op->oob;
+	int sectors = phys_writesize / 1024, run_pages = multipage.run_pages;
+	int first = 0, pages, next, next_pages = 0, p;
+
+	nfc_cache_read_end();
+	pages = min_t(int, op->len, run_pages);
+	nfc_read_run_start(op, first, pages);
+	while (first < op->len) {
+		nfc_read_page_dma_finish(pages * sectors, user_data + first * sectors);
+		ecc_harvest(&snap, pages * sectors);
+
+		// next run goes while this one is decoded
+		next = first + pages;
+		if (next < op->len) {
+			next_pages = min_t(int, op->len - next, run_pages);
+			nfc_read_run_start(op, next, next_pages);
+		}
+
+		for (p = 0; p < pages; p++)
+			multipage.result[first + p] =
+				ecc_decode(&snap, p * sectors, (p + 1) * sectors,
+						   (uint8_t *)op->buf + first * op->mtd->writesize,
+						   user_data + first * sectors);
+
+		first = next;
+		pages = next_pages;
+	}
+	op->result = 0;
+}
+
+// called by nfc_read_page(), return 1 when the page is served from the
+// pages read ahead with its ECC result in *stat, 0 to read it as usual
+static int nfc_read_ahead(struct mtd_info *mtd, uint8_t *buf, int page,
+						  uint8_t *oob, int *stat)
+{
+	struct multipage_read *mr = &multipage;
+	int idx = page - mr->page, sectors = mtd->writesize / 1024;
+
+	if (!mr->pages || mr->task != current || idx < 0 || idx >= mr->pages ||
+		buf != mr->buf + idx * mtd->writesize)
+		return 0;
+
+	if (idx < mr->first || idx >= mr->first + mr->count) {
+		struct nfc_op op = { .run = nfc_read_pages_op, .mtd = mtd, .command = NAND_CMD_READ0,
+							 .page = page, .buf = buf, .oob = mr->user_data };
+
+		// the last page alone is read as usual
+		if (mr->pages - idx < 2)
+			return 0;
+		op.len = min_t(int, mr->pages - idx, mr->run_pages * MULTIPAGE_MAX_RUNS);
+		nfc_op_run(&op);
+		mr->first = idx;
+		mr->count = op.len;
+	}
+
+	idx -= mr->first;
+	if (mr->result[idx] < 0) {
+		// erased sectors are told already, read it alone to be sure
+		multipage_fallback_count++;
+		return 0;
+	}
+	memcpy(oob, mr->user_data + idx * sectors, sectors * 4);
+	*stat = mr->result[idx];
+	multipage_read_count++;
+	return 1;
+}
+
+// sectors of a plane page to read, fewer than all for the last page of
+// a short read
+static int nfc_read_sectors(struct mtd_info *mtd, struct nand_chip *chip, const uint8_t *buf,
+							int page)
+{
+	struct short_read *sr = &short_read;
+
+	if (sr->task != current || page != sr->page || buf != chip->buffers->databuf)
+		return phys_writesize / 1024;
+	sr->done = 1;
+	short_read_count++;
+	return sr->sectors;
+}
+
+static int nfc_mtd_do_read(struct mtd_info *mtd, loff_t from, size_t len,
+						   size_t *retlen, u_char *buf)
+{
+	struct nand_chip *chip = mtd->priv;
+	loff_t last = from + len - 1;
+	int ret, sectors = len ? (last & (mtd->writesize - 1)) / 1024 + 1 : 0;
+
+	if (short_read_on && len && sectors < mtd->writesize / 1024) {
+		mutex_lock(&multipage_lock);
+		short_read.task = current;
+		short_read.page = (last >> chip->page_shift) & chip->pagemask;
+		short_read.sectors = sectors;
+		short_read.done = 0;
+		ret = nand_base_read(mtd, from, len, retlen, buf);
+		short_read.task = NULL;
+		mutex_unlock(&multipage_lock);
+		return ret;
+	}
+
+	if (!multipage_on || ((from | len) & (mtd->writesize - 1)) || len < 2 * mtd->writesize ||
+		!dma_able(buf, len))
+		return nand_base_read(mtd, from, len, retlen, buf);
+
+	mutex_lock(&multipage_lock);
+	multipage.task = current;
+	multipage.buf = buf;
+	multipage.page = from >> chip->page_shift;
+	multipage.pages = len >> chip->page_shift;
+	multipage.count = 0;
+	ret = nand_base_read(mtd, from, len, retlen, buf);
+	multipage.pages = 0;
+	mutex_unlock(&multipage_lock);
+	return ret;
+}
+
+// MTD read, timed in read_latency_hist with read_latency_switch on
+static int nfc_mtd_read(struct mtd_info *mtd, loff_t from, size_t len,
+						size_t *retlen, u_char *buf)
+{
+	ktime_t start;
+	unsigned int lat;
+	int ret, bucket;
+
+	if (!read_latency_switch)
+		return nfc_mtd_do_read(mtd, from, len, retlen, buf);
+
+	start = ktime_get();
+	ret = nfc_mtd_do_read(mtd, from, len, retlen, buf);
+	lat = ktime_us_delta(ktime_get(), start);
+	bucket = lat ? ilog2(lat) : 0;
+	if (bucket >= READ_LATENCY_BUCKETS)
+		bucket = READ_LATENCY_BUCKETS - 1;
+	read_latency_hist[bucket]++;
+	return ret;
+}
+
+// Sub-page write
+//
+// nand_base pads a write not covering a whole page with 0xff and
+// programs the page as usual. mtd->_write and mtd->_write_oob are wrapped
+// to record the range of such a write, and only the sectors in it are
+// programmed, the others are left erased for later sub-page writes.
+
+static DEFINE_MUTEX(subpage_lock);
+
+static int (*nand_base_write)(struct mtd_info *mtd, loff_t to, size_t len,
+							  size_t *retlen, const u_char *buf);
+static int (*nand_base_write_oob)(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops);
+
+static int nfc_mtd_write(struct mtd_info *mtd, loff_t to, size_t len,
+						 size_t *retlen, const u_char *buf)
+{
+	int ret;
+
+	if (!((to | len) & (mtd->writesize - 1)))
+		return nand_base_write(mtd, to, len, retlen, buf);
+
+	mutex_lock(&subpage_lock);
+	subpage.task = current;
+	subpage.start = to;
+	subpage.end = to + len;
+	ret = nand_base_write(mtd, to, len, retlen, buf);
+	subpage.task = NULL;
+	mutex_unlock(&subpage_lock);
+	return ret;
+}
+
+static int nfc_mtd_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
+{
+	int ret;
+
+	if (!ops->datbuf || !((to | ops->len) & (mtd->writesize - 1)))
+		return nand_base_write_oob(mtd, to, ops);
+
+	mutex_lock(&subpage_lock);
+	subpage.task = current;
+	subpage.start = to;
+	subpage.end = to + ops->len;
+	ret = nand_base_write_oob(mtd, to, ops);
+	subpage.task = NULL;
+	mutex_unlock(&subpage_lock);
+	return ret;
+}
+
+// called after nand_scan_tail() set up the MTD ops
+void nfc_setup_mtd_ops(struct mtd_info *mtd)
+{
+	struct nand_chip *chip = mtd->priv;
+
+	// two planes and interleaved chips are read whole
+	short_read_on = plane_num == 1 && way_num == 1;
+
+	// random seed is per page, hardware ECC tells erased pages, a run
+	// must have two pages at least and stay in one chip
+	if (multipage_switch && !random_switch && hwecc_switch && plane_num == 1 && way_num == 1 &&
+		mtd->writesize / 1024 * 2 <= MULTIPAGE_MAX_SECTORS && chip->numchips == 1) {
+		multipage_on = 1;
+		multipage.run_pages = MULTIPAGE_MAX_SECTORS / (mtd->writesize / 1024);
+		DBG_INFO("multi-page read is on\n");
+	}
+
+	if (short_read_on || multipage_on || read_latency_switch) {
+		nand_base_read = mtd->_read;
+		mtd->_read = nfc_mtd_read;
+	}
+
+	// nand_base enables sub-page write with subpage_switch on, sectors
+	// are programmed with ECC one by one
+	if (mtd->subpage_sft && hwecc_switch) {
+		nand_base_write = mtd->_write;
+		mtd->_write = nfc_mtd_write;
+		nand_base_write_oob = mtd->_write_oob;
+		mtd->_write_oob = nfc_mtd_write_oob;
+		DBG_INFO("sub-page write is on\n");
+	}
+}
+
+// DMA page data to caller buffer directly, only use read_buffer when
+// the caller buffer can't be DMAed (like vmalloc buffer of UBI)
+static int nfc_read_page(struct mtd_info *mtd, struct nand_chip *chip, uint8_t *buf, int page)
+{
+	int stat, sectors = nfc_read_sectors(mtd, chip, buf, page);
+	// sectors of all planes and chips
+	int sector_count = sectors * plane_num * way_num;
+
+	read_page_pending = 0;
+
+	if (!nfc_read_ahead(mtd, buf, page, chip->oob_poi, &stat)) {
+		if (dma_able(buf, sector_count * 1024)) {
+			stat = nfc_read_page_sync(mtd, page, sectors, buf, (uint32_t *)chip->oob_poi);
+		}
+		else {
+			read_bounce_count++;
+			stat = nfc_read_page_sync(mtd, page, sectors, read_buffer,
+									  (uint32_t *)chip->oob_poi);
+			memcpy(buf, read_buffer, sector_count * 1024);
+		}
+	}
+	memset(chip->oob_poi + sector_count * 4, 0xff, mtd->oobsize - sector_count * 4);
+
+	if (hwecc_switch) {
+		if (stat < 0)
+			mtd->ecc_stats.failed++;
+		else
+			mtd->ecc_stats.corrected += stat;
+	}
+	return 0;
+}
+
+// NAND_CMD_PAGEPROG will DMA from caller buffer directly instead of
+// copying page to write_buffer by nfc_write_buf(). Raw pages still go
+// through nand_base's write_page_raw and nfc_write_buf() with ECC, as
+// raw reads through nfc_read_buf() are ECC checked too.
+static void nfc_write_page(struct mtd_info *mtd, struct nand_chip *chip, const uint8_t *buf)
+{
+	program_buf = buf;
+	program_oob = chip->oob_poi;
+}
+
+// nand_write_page() of nand_base never uses cache program, 15h is used
+// here when nand_base tells the next page in the same block follows
+static int nfc_write_page_cached(struct mtd_info *mtd, struct nand_chip *chip,
+								 const uint8_t *buf, int page, int cached, int raw)
+{
+	int status, fail = NAND_STATUS_FAIL, first, end;
+	int blockmask = (1 << (chip->phys_erase_shift - chip->page_shift)) - 1;
+
+	// nand_base checks the page number against blockmask instead of the
+	// page in block, cache program must not run across blocks
+	cached = cached && (page & blockmask) != blockmask;
+	// a sub-page is programmed by 10h
+	if (cached && nfc_subpage_range(mtd, page, &first, &end))
+		cached = 0;
+	// failure of the previous page is reported by the next one
+	if (cache_prog_run)
+		fail |= NAND_STATUS_FAIL_N1;
+	cache_prog_run = cached;
+
+	chip->cmdfunc(mtd, NAND_CMD_SEQIN, 0x00, page);
+
+	if (unlikely(raw))
+		chip->ecc.write_page_raw(mtd, chip, buf);
+	else
+		chip->ecc.write_page(mtd, chip, buf);
+
+	if (cached) {
+		cache_prog_count++;
+		chip->cmdfunc(mtd, NAND_CMD_CACHEDPROG, -1, -1);
+	}
+	else {
+		chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
+	}
+	status = chip->waitfunc(mtd, chip);
+	if (status & fail) {
+		cache_prog_run = 0;
+		return -EIO;
+	}
+	return 0;
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // 1K mode for SPL read/write
 
@@ -721,18 +2507,25 @@ struct save_1k_mode {
 	uint32_t ctl;
 	uint32_t ecc_ctl;
 	uint32_t spare_area;
+	// chip selected by MTD, 1K ops may run between MTD ops
+	uint32_t chip_sel;
+	int chip;
 };
 
 static void enter_1k_mode(struct save_1k_mode *save)
 {
 	uint32_t ctl;
 
-	ctl = readl(NFC_REG_CTL);
+	save->chip_sel = nfc_ctl & (NFC_CE_SEL | NFC_RB_SEL);
+	save->chip = cur_chip;
+	select_chip(0);
+
+	ctl = nfc_ctl;
 	save->ctl = ctl;
 	ctl &= ~NFC_PAGE_SIZE;
-	writel(ctl, NFC_REG_CTL);
+	write_ctl(ctl);
 	
-	ctl = readl(NFC_REG_ECC_CTL);
+	ctl = nfc_ecc_ctl;
 	save->ecc_ctl = ctl;
 	set_ecc_mode(8);
 
@@ -743,24 +2536,25 @@ static void enter_1k_mode(struct save_1k_mode *save)
 
 static void exit_1k_mode(struct save_1k_mode *save)
 {
-	writel(save->ctl, NFC_REG_CTL);
-	writel(save->ecc_ctl, NFC_REG_ECC_CTL);
+	write_ctl((save->ctl & ~(NFC_CE_SEL | NFC_RB_SEL)) | save->chip_sel);
+	write_ecc_ctl(save->ecc_ctl);
 	writel(save->spare_area, NFC_REG_SPARE_AREA);
+	cur_chip = save->chip;
 }
 
-void nfc_read_page1k(uint32_t page_addr, void *buff)
+static void nfc_read_page1k_op(struct nfc_op *op)
 {
 	struct save_1k_mode save;
+	uint32_t page_addr = op->page;
+	void *buff = op->buf;
 	uint32_t cfg = NAND_CMD_READ0 | NFC_SEQ | NFC_SEND_CMD1 | NFC_DATA_TRANS | NFC_SEND_ADR | 
 		NFC_SEND_CMD2 | ((5 - 1) << 16) | NFC_WAIT_FLAG | NFC_DATA_SWAP_METHOD | (2 << 30);
 
-	nfc_select_chip(NULL, 0);
-
 	wait_cmdfifo_free();
 
 	enter_1k_mode(&save);
 
-	writel(readl(NFC_REG_CTL) | NFC_RAM_METHOD, NFC_REG_CTL);
+	set_ram_method(1);
 	dma_nand_config_start(dma_hdle, 0, (uint32_t)buff, 1024);
 
 	writel(page_addr << 16, NFC_REG_ADDR_LOW);
@@ -773,10 +2567,11 @@ void nfc_read_page1k(uint32_t page_addr, void *buff)
 	if (hwecc_switch)
 		enable_ecc(1);
 
-	writel(cfg, NFC_REG_CMD);
+	send_cmd(cfg);
 
 	dma_nand_wait_finish();
-	wait_cmdfifo_free();
+	if (!cmd_irq_on())
+		wait_cmdfifo_free();
 	wait_cmd_finish();
 
 	if (hwecc_switch) {
@@ -786,24 +2581,30 @@ void nfc_read_page1k(uint32_t page_addr, void *buff)
 	disable_random();
 
 	exit_1k_mode(&save);
+}
+
+void nfc_read_page1k(uint32_t page_addr, void *buff)
+{
+	struct nfc_op op = { .run = nfc_read_page1k_op, .command = NAND_CMD_READ0,
+						 .page = page_addr, .buf = buff };
 
-	nfc_select_chip(NULL, -1);
+	nfc_op_run(&op);
 }
 
-void nfc_write_page1k(uint32_t page_addr, void *buff)
+static void nfc_write_page1k_op(struct nfc_op *op)
 {
 	struct save_1k_mode save;
+	uint32_t page_addr = op->page;
+	void *buff = op->buf;
 	uint32_t cfg = NAND_CMD_SEQIN | NFC_SEQ | NFC_SEND_CMD1 | NFC_DATA_TRANS | NFC_SEND_ADR | 
 		NFC_SEND_CMD2 | ((5 - 1) << 16) | NFC_WAIT_FLAG | NFC_DATA_SWAP_METHOD | NFC_ACCESS_DIR | 
 		(2 << 30);
 
-	nfc_select_chip(NULL, 0);
-
 	wait_cmdfifo_free();
 
 	enter_1k_mode(&save);
 
-	writel(readl(NFC_REG_CTL) | NFC_RAM_METHOD, NFC_REG_CTL);
+	set_ram_method(1);
 	dma_nand_config_start(dma_hdle, 1, (uint32_t)buff, 1024);
 
 	writel(page_addr << 16, NFC_REG_ADDR_LOW);
@@ -816,10 +2617,11 @@ void nfc_write_page1k(uint32_t page_addr, void *buff)
 	if (hwecc_switch)
 		enable_ecc(1);
 
-	writel(cfg, NFC_REG_CMD);
+	send_cmd(cfg);
 
 	dma_nand_wait_finish();
-	wait_cmdfifo_free();
+	if (!cmd_irq_on())
+		wait_cmdfifo_free();
 	wait_cmd_finish();
 
 	if (hwecc_switch)
@@ -828,8 +2630,14 @@ void nfc_write_page1k(uint32_t page_addr, void *buff)
 	disable_random();
 
 	exit_1k_mode(&save);
+}
+
+void nfc_write_page1k(uint32_t page_addr, void *buff)
+{
+	struct nfc_op op = { .run = nfc_write_page1k_op, .command = NAND_CMD_PAGEPROG,
+						 .page = page_addr, .buf = buff };
 
-	nfc_select_chip(NULL, -1);
+	nfc_op_run(&op);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
@@ -849,6 +2657,13 @@ static void first_test_nfc(struct mtd_info *mtd)
 			 nfc_read_byte(mtd),  nfc_read_byte(mtd));
 }
 
+// chips probed by nand_scan_ident(), the other CE lines only when their
+// chips are interleaved, so the MTD geometry stays as it was without
+int nfc_max_chips(void)
+{
+	return interleave_switch ? NFC_MAX_CHIP_NUM : 1;
+}
+
 int nfc_first_init(struct mtd_info *mtd)
 {
 	uint32_t ctl;
@@ -875,6 +2690,13 @@ int nfc_first_init(struct mtd_info *mtd)
 		DBG_INFO("random read/write is off\n");
 	}
 
+	if (irq_switch) {
+		DBG_INFO("wait command by interrupt\n");
+	}
+	else {
+		DBG_INFO("wait command by polling\n");
+	}
+
 	// set NFC clock source
 	sunxi_set_nand_clock(20);
 
@@ -886,10 +2708,11 @@ int nfc_first_init(struct mtd_info *mtd)
 	ctl |= NFC_RESET;
 	writel(ctl, NFC_REG_CTL);
 	while(readl(NFC_REG_CTL) & NFC_RESET);
+	nfc_ecc_ctl = readl(NFC_REG_ECC_CTL);
 
 	// enable NFC
 	ctl = NFC_EN;
-	writel(ctl, NFC_REG_CTL);
+	write_ctl(ctl);
 
 	// serial_access_mode = 1
 	// this is needed by some nand chip to read ID
@@ -902,6 +2725,8 @@ int nfc_first_init(struct mtd_info *mtd)
 	nand->ecc.hwctl = nfc_ecc_hwctl;
 	nand->ecc.calculate = nfc_ecc_calculate;
 	nand->ecc.correct = nfc_ecc_correct;
+	nand->ecc.read_page = nfc_read_page;
+	nand->ecc.write_page = nfc_write_page;
 	nand->select_chip = nfc_select_chip;
 	nand->dev_ready = nfc_dev_ready;
 	nand->cmdfunc = nfc_cmdfunc;
@@ -930,6 +2755,32 @@ static void print_page(struct mtd_info *mtd, int page)
 	printk("\n");
 }
 
+// CPU cost of the ECC_CTL setup of a page transfer, read-modify-write
+// helpers against the precomputed descriptor
+static void bench_xfer_desc(void)
+{
+	ktime_t start;
+	int i, rmw, desc;
+
+	start = ktime_get();
+	for (i = 0; i < 1000; i++) {
+		enable_random(i);
+		enable_ecc(1);
+		disable_ecc();
+		disable_random();
+	}
+	rmw = ktime_us_delta(ktime_get(), start);
+
+	start = ktime_get();
+	for (i = 0; i < 1000; i++) {
+		xfer_begin(i, 1);
+		xfer_end();
+	}
+	desc = ktime_us_delta(ktime_get(), start);
+
+	DBG_INFO("1000 page transfer setups: read-modify-write %dus, descriptor %dus\n", rmw, desc);
+}
+
 static void test_nfc(struct mtd_info *mtd)
 {
 	int i, j, n=0;
@@ -998,7 +2849,7 @@ static void test_ops(struct mtd_info *mtd)
 	// NFC_REG_CNT = n, fetch n byte to RAM
 	writel(1, NFC_REG_CNT);
 	writel(v2, NFC_REG_RCMD_SET);
-	writel(v1, NFC_REG_CMD);
+	send_cmd(v1);
 	wait_cmdfifo_free();
 	wait_cmd_finish();
 	DBG_INFO("SEQ READ IO: %x %x %x %x %x %x\n", 
@@ -1017,6 +2868,337 @@ static void test_ops(struct mtd_info *mtd)
 			 readb(NFC_RAM0_BASE + 5));
 }
 
+// Write a pattern to the OOB free area of an erased page and read it back
+// the way nand_base's write_oob/read_oob do, the block of the page is
+// erased before and after
+static void test_oob(struct mtd_info *mtd, int page)
+{
+	struct nand_chip *nand = mtd->priv;
+	struct nand_oobfree *free = nand->ecc.layout->oobfree;
+	int i, status, block = page & ~((1 << (nand->phys_erase_shift - nand->page_shift)) - 1);
+	uint8_t *oob, *back;
+
+	oob = kmalloc(mtd->oobsize * 2, GFP_KERNEL);
+	if (oob == NULL) {
+		ERR_INFO("alloc OOB test buffer fail\n");
+		return;
+	}
+	back = oob + mtd->oobsize;
+	memset(oob, 0xff, mtd->oobsize);
+	for (i = 0; i < free->length; i++)
+		oob[free->offset + i] = i;
+
+	nfc_select_chip(mtd, 0);
+	nfc_cmdfunc(mtd, NAND_CMD_ERASE1, -1, block);
+	nfc_cmdfunc(mtd, NAND_CMD_ERASE2, -1, -1);
+	nfc_wait(mtd, nand);
+
+	nfc_cmdfunc(mtd, NAND_CMD_SEQIN, mtd->writesize, page);
+	nfc_write_buf(mtd, oob, mtd->oobsize);
+	nfc_cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
+	status = nfc_wait(mtd, nand);
+
+	nfc_cmdfunc(mtd, NAND_CMD_READOOB, 0, page);
+	nfc_read_buf(mtd, back, mtd->oobsize);
+
+	if (status & NAND_STATUS_FAIL)
+		ERR_INFO("OOB test program fail at %d\n", page);
+	else if (memcmp(oob + free->offset, back + free->offset, free->length)) {
+		for (i = 0; i < free->length; i++) {
+			if (oob[free->offset + i] != back[free->offset + i])
+				break;
+		}
+		ERR_INFO("OOB test mismatch at %d:%d %x != %x\n", page, free->offset + i,
+				 back[free->offset + i], oob[free->offset + i]);
+	}
+	else
+		DBG_INFO("OOB test of %d bytes at %d ok\n", free->length, page);
+
+	nfc_cmdfunc(mtd, NAND_CMD_ERASE1, -1, block);
+	nfc_cmdfunc(mtd, NAND_CMD_ERASE2, -1, -1);
+	nfc_wait(mtd, nand);
+	nfc_select_chip(mtd, -1);
+	kfree(oob);
+}
+
+// Clock and timing calibration
+//
+// The clock never goes above the rated one of the chip. The reference
+// page is read at the rated clock first, trying the serial access (EDO)
+// mode off and on, and the clock is stepped down until it reads with
+// ECC. A clock below the rated one is backed off by calibrate_margin.
+// Then the TIMING_CFG delays are shortened. A setting is stable when
+// every read of the page gives the reference data with no more bitflips
+// than the reference reads. The result is exported as calibrated_*
+// parameters, which are applied without the sweep when given at load
+// time, a timing register not given keeps its default.
+
+#define CALIBRATE_READS      4
+#define CALIBRATE_CLOCK_STEP 2
+#define CALIBRATE_MIN_CLOCK  10
+
+static const uint32_t calibrate_timing_cfgs[] = { 0xff, 0xaa, 0x55 };
+
+static void set_nand_timing(uint32_t clock, uint32_t timing_ctl, uint32_t timing_cfg)
+{
+	sunxi_set_nand_clock(clock);
+	writel(timing_ctl, NFC_REG_TIMING_CTL);
+	writel(timing_cfg, NFC_REG_TIMING_CFG);
+}
+
+// read the reference page, return the max bitflips or -1 for unstable
+static int calibrate_read(int page, const uint8_t *ref, uint32_t *user_data)
+{
+	int i, bits, max_bits = 0, sector_count = phys_writesize / 1024;
+
+	for (i = 0; i < CALIBRATE_READS; i++) {
+		nfc_read_page_dma(NAND_CMD_READ0, NAND_CMD_READSTART, page, sector_count,
+						  read_buffer, user_data);
+		bits = ecc_bitflips(sector_count);
+		if (bits < 0 || (ref && memcmp(read_buffer, ref, phys_writesize)))
+			return -1;
+		if (bits > max_bits)
+			max_bits = bits;
+	}
+	return max_bits;
+}
+
+static void nfc_calibrate(uint32_t rated_clock)
+{
+	int clock, best_clock;
+	uint32_t best_ctl, best_cfg, ctl;
+	uint32_t def_ctl, def_cfg;
+	uint32_t user_data[16];
+	uint8_t *ref;
+	int i, ref_bits = -1, bits;
+
+	if (calibrated_clock) {
+		if (calibrated_clock > rated_clock)
+			calibrated_clock = rated_clock;
+		if (calibrated_timing_ctl < 0)
+			calibrated_timing_ctl = readl(NFC_REG_TIMING_CTL);
+		if (calibrated_timing_cfg < 0)
+			calibrated_timing_cfg = readl(NFC_REG_TIMING_CFG);
+		set_nand_timing(calibrated_clock, calibrated_timing_ctl, calibrated_timing_cfg);
+		DBG_INFO("set calibrated clock %dMHz timing %x/%x\n", calibrated_clock,
+				 calibrated_timing_ctl, calibrated_timing_cfg);
+		return;
+	}
+
+	if (calibrate_page < 0 || !hwecc_switch)
+		return;
+
+	ref = kmalloc(phys_writesize, GFP_KERNEL);
+	if (ref == NULL) {
+		ERR_INFO("alloc calibration buffer fail\n");
+		return;
+	}
+
+	select_chip(0);
+	best_clock = rated_clock;
+	best_ctl = def_ctl = readl(NFC_REG_TIMING_CTL);
+	best_cfg = def_cfg = readl(NFC_REG_TIMING_CFG);
+
+	for (clock = rated_clock; clock >= CALIBRATE_MIN_CLOCK; clock -= CALIBRATE_CLOCK_STEP) {
+		for (i = 0; i < 2; i++) {
+			ctl = (def_ctl & ~NFC_TIMING_EDO) | (i ? NFC_TIMING_EDO : 0);
+			set_nand_timing(clock, ctl, def_cfg);
+			if ((ref_bits = calibrate_read(calibrate_page, NULL, user_data)) >= 0)
+				break;
+		}
+		if (i < 2)
+			break;
+	}
+	if (ref_bits < 0) {
+		ERR_INFO("calibration page %d unreadable, skip calibration\n", calibrate_page);
+		best_ctl = def_ctl;
+		goto out;
+	}
+	memcpy(ref, read_buffer, phys_writesize);
+	best_ctl = ctl;
+
+	// safety margin below the rated clock
+	if (clock < rated_clock)
+		clock -= calibrate_margin;
+	if (clock < CALIBRATE_MIN_CLOCK)
+		clock = CALIBRATE_MIN_CLOCK;
+	best_clock = clock;
+
+	for (i = 1; i < ARRAY_SIZE(calibrate_timing_cfgs); i++) {
+		set_nand_timing(best_clock, best_ctl, calibrate_timing_cfgs[i]);
+		bits = calibrate_read(calibrate_page, ref, user_data);
+		if (bits < 0 || bits > ref_bits)
+			break;
+	}
+
+	// safety margin, one step of TIMING_CFG
+	best_cfg = calibrate_timing_cfgs[i > 1 ? i - 2 : 0];
+
+	set_nand_timing(best_clock, best_ctl, best_cfg);
+	bits = calibrate_read(calibrate_page, ref, user_data);
+	if (bits < 0 || bits > ref_bits) {
+		ERR_INFO("calibrated timing unstable, keep default\n");
+		best_clock = rated_clock;
+		best_ctl = def_ctl;
+		best_cfg = def_cfg;
+		goto out;
+	}
+
+	DBG_INFO("calibrated clock %dMHz timing %x/%x, %d bitflips\n",
+			 best_clock, best_ctl, best_cfg, ref_bits);
+	calibrated_clock = best_clock;
+	calibrated_timing_ctl = best_ctl;
+	calibrated_timing_cfg = best_cfg;
+
+out:
+	set_nand_timing(best_clock, best_ctl, best_cfg);
+	kfree(ref);
+}
+
+// ONFI parameter page
+//
+// nand_base reads and checks the parameter page of ONFI chips, and takes
+// the geometry from it. The timing mode, plane and cache capabilities
+// and ECC requirement are taken here from nand->onfi_params. Table
+// entries keep their ECC mode as it sets the on-flash format.
+
+// ONFI features and optional commands bits
+#define ONFI_FEATURE_MULTI_PLANE_PROG (1 << 3)
+#define ONFI_FEATURE_MULTI_PLANE_READ (1 << 6)
+#define ONFI_OPT_CMD_CACHE_PROG (1 << 0)
+#define ONFI_OPT_CMD_CACHE_READ (1 << 1)
+#define ONFI_OPT_CMD_FEATURES   (1 << 2)
+
+// tRC (ns) of ONFI async timing mode 0-5
+static const int onfi_trc[] = { 100, 50, 35, 30, 25, 20 };
+// max corrected bits of a 1K sector of each ECC mode
+static const int ecc_mode_bits[] = { 16, 24, 28, 32, 40, 48, 56, 60, 64 };
+
+static struct nand_chip_param onfi_chip_param;
+
+// smallest ECC mode correcting ecc_bits per 512 bytes with parity and
+// user data fitting in the spare area, the strongest fitting one for
+// unknown requirement
+static int onfi_ecc_mode(struct mtd_info *mtd, int ecc_bits)
+{
+	int mode, fit = 0, sector_spare = mtd->oobsize / (mtd->writesize / 1024);
+
+	for (mode = 0; mode < ARRAY_SIZE(ecc_mode_bits); mode++) {
+		if (ecc_parity_bytes[mode] + 4 > sector_spare)
+			break;
+		fit = mode;
+		if (ecc_bits != 0xff && ecc_mode_bits[mode] >= ecc_bits * 2)
+			break;
+	}
+	return fit;
+}
+
+// switch all chips to the slowest timing mode the chip supports that
+// still reaches the NFC max clock, or to its fastest one if none, return
+// the mode verified by GET FEATURES, 0 on failure as chips power on in it
+static int onfi_set_timing_mode(struct nand_chip *nand)
+{
+	struct nand_onfi_params *p = &nand->onfi_params;
+	int modes = le16_to_cpu(p->async_timing_mode) & 0x3f;
+	int mode, c, err = 0;
+	uint8_t param[ONFI_FEATURE_PARAM_LEN];
+
+	if (!(le16_to_cpu(p->opt_cmd) & ONFI_OPT_CMD_FEATURES) || !modes)
+		return 0;
+
+	for (mode = 0; mode < ARRAY_SIZE(onfi_trc); mode++) {
+		if ((modes & (1 << mode)) && 1000 / onfi_trc[mode] >= NFC_SDR_MAX_CLOCK)
+			break;
+	}
+	if (mode == ARRAY_SIZE(onfi_trc))
+		mode = fls(modes) - 1;
+	if (mode == 0)
+		return 0;
+
+	for (c = 0; c < nand->numchips; c++) {
+		select_chip(c);
+		memset(param, 0, sizeof(param));
+		param[0] = mode;
+		set_feature(ONFI_FEATURE_ADDR_TIMING_MODE, param);
+		get_feature(ONFI_FEATURE_ADDR_TIMING_MODE, param);
+		if ((param[0] & 0xf) != mode) {
+			ERR_INFO("chip %d refuses timing mode %d (%x)\n", c, mode, param[0]);
+			err = 1;
+		}
+	}
+
+	// back to mode 0 for all, a chip may have been switched
+	if (err) {
+		memset(param, 0, sizeof(param));
+		for (c = 0; c < nand->numchips; c++) {
+			select_chip(c);
+			set_feature(ONFI_FEATURE_ADDR_TIMING_MODE, param);
+		}
+		mode = 0;
+	}
+
+	select_chip(0);
+	return mode;
+}
+
+// chip param from the parameter page, ecc_mode of the table entry is kept
+static struct nand_chip_param *onfi_chip_param_get(struct mtd_info *mtd, struct nand_chip *nand,
+												   struct nand_chip_param *table)
+{
+	struct nand_onfi_params *p = &nand->onfi_params;
+	uint16_t features = le16_to_cpu(p->features);
+	uint16_t opt_cmd = le16_to_cpu(p->opt_cmd);
+	int mode = onfi_set_timing_mode(nand);
+
+	// table clocks are known to work in mode 0
+	if (mode == 0 && table)
+		onfi_chip_param.clock_freq = table->clock_freq;
+	else
+		onfi_chip_param.clock_freq = 1000 / onfi_trc[mode];
+	// capabilities not in the parameter page
+	onfi_chip_param.options = table ? table->options & SUNXI_NAND_TOGGLE : 0;
+	if (p->interleaved_bits == 1 &&
+		(features & ONFI_FEATURE_MULTI_PLANE_PROG) &&
+		(features & ONFI_FEATURE_MULTI_PLANE_READ))
+		onfi_chip_param.options |= SUNXI_NAND_TWO_PLANE;
+	if (opt_cmd & ONFI_OPT_CMD_CACHE_READ)
+		onfi_chip_param.options |= SUNXI_NAND_CACHE_READ;
+	if (opt_cmd & ONFI_OPT_CMD_CACHE_PROG)
+		onfi_chip_param.options |= SUNXI_NAND_CACHE_PROG;
+	if (table) {
+		memcpy(onfi_chip_param.id, table->id, sizeof(table->id));
+		onfi_chip_param.id_len = table->id_len;
+		onfi_chip_param.ecc_mode = table->ecc_mode;
+	}
+	else
+		onfi_chip_param.ecc_mode = onfi_ecc_mode(mtd, p->ecc_bits);
+
+	DBG_INFO("ONFI timing mode %d, ECC %d bits, ECC mode %d, options %x\n",
+			 mode, p->ecc_bits, onfi_chip_param.ecc_mode, onfi_chip_param.options);
+	return &onfi_chip_param;
+}
+
+// cell type from the parameter page, or ID byte 2 as nand_base decodes it
+static int nfc_chip_is_slc(struct nand_chip *nand, uint8_t *id)
+{
+	if (nand->onfi_version)
+		return nand->onfi_params.bits_per_cell == 1;
+	return !(id[2] & NAND_CI_CELLTYPE_MSK);
+}
+
+// expose 1 << shift pages (of planes or chips) as one MTD page
+static void scale_geometry(struct mtd_info *mtd, struct nand_chip *nand, int shift)
+{
+	mtd->writesize <<= shift;
+	mtd->oobsize <<= shift;
+	mtd->erasesize <<= shift;
+	nand->page_shift += shift;
+	nand->phys_erase_shift += shift;
+	nand->bbt_erase_shift += shift;
+	nand->pagemask = (nand->chipsize >> nand->page_shift) - 1;
+	nand->options |= NAND_NO_SUBPAGE_WRITE;
+}
+
 int nfc_second_init(struct mtd_info *mtd)
 {
 	int i, err, j;
@@ -1025,7 +3207,8 @@ int nfc_second_init(struct mtd_info *mtd)
 	struct nand_chip_param *nand_chip_param, *chip_param = NULL;
 	struct nand_chip *nand = mtd->priv;
 
-	// get nand chip id
+	// get nand chip id, chips are deselected after scanning
+	nfc_select_chip(mtd, 0);
 	nfc_cmdfunc(mtd, NAND_CMD_READID, 0, -1);
 	for (i = 0; i < 8; i++)
 		id[i] = nfc_read_byte(mtd);
@@ -1050,6 +3233,10 @@ int nfc_second_init(struct mtd_info *mtd)
 		}
 	}
 
+	// parameter page read by nand_base
+	if (nand->onfi_version)
+		chip_param = onfi_chip_param_get(mtd, nand, chip_param);
+
 	// not find
 	if (chip_param == NULL) {
 		ERR_INFO("can't find nand chip in sunxi database\n");
@@ -1057,8 +3244,12 @@ int nfc_second_init(struct mtd_info *mtd)
 	}
 
 	// set final NFC clock freq
-	if (chip_param->clock_freq > 30)
-		chip_param->clock_freq = 30;
+	if (toggle_switch && (chip_param->options & SUNXI_NAND_TOGGLE)) {
+		toggle_on = 1;
+		DBG_INFO("toggle DDR interface is on\n");
+	}
+	else if (chip_param->clock_freq > NFC_SDR_MAX_CLOCK)
+		chip_param->clock_freq = NFC_SDR_MAX_CLOCK;
 	sunxi_set_nand_clock(chip_param->clock_freq);
 	DBG_INFO("set final clock freq to %dMHz\n", chip_param->clock_freq);
 
@@ -1069,6 +3260,7 @@ int nfc_second_init(struct mtd_info *mtd)
 
 	// set ECC mode
 	set_ecc_mode(chip_param->ecc_mode);
+	nfc_build_xfer_desc();
 
 	// enable NFC
 	ctl = NFC_EN;
@@ -1090,7 +3282,14 @@ int nfc_second_init(struct mtd_info *mtd)
 	}
 	// 0 for 1K
 	ctl |= ((nand->page_shift - 10) & 0xf) << 8;
-	writel(ctl, NFC_REG_CTL);
+	// toggle NAND takes commands and addresses the same way, only the data
+	// is strobed by DQS on both edges
+	if (toggle_on) {
+		ctl |= NFC_DDR_TYPE_TOGGLE;
+		writel((readl(NFC_REG_TIMING_CTL) & ~NFC_TIMING_DC_CTL) |
+			   (toggle_dqs_delay & NFC_TIMING_DC_CTL), NFC_REG_TIMING_CTL);
+	}
+	write_ctl(ctl);
 
 	writel(0xff, NFC_REG_TIMING_CFG);
 	writel(1 << nand->page_shift, NFC_REG_SPARE_AREA);
@@ -1098,13 +3297,73 @@ int nfc_second_init(struct mtd_info *mtd)
 	// disable random
 	disable_random();
 
+	phys_writesize = mtd->writesize;
+	phys_oobsize = mtd->oobsize;
+	block_page_shift = nand->phys_erase_shift - nand->page_shift;
+
+	// two-plane mode, NFC still works on the page of a single plane
+	if (multiplane_switch && (chip_param->options & SUNXI_NAND_TWO_PLANE)) {
+		plane_num = 2;
+		onfi_plane_cmd = nand->onfi_version || id[0] == NAND_MFR_MICRON || id[0] == NAND_MFR_INTEL;
+		scale_geometry(mtd, nand, 1);
+		DBG_INFO("two-plane mode is on\n");
+	}
+
+	// chip interleave mode, all chips are seen as one by nand_base
+	if (interleave_switch && nand->numchips > 1) {
+		int shift = ilog2(nand->numchips);
+
+		way_num = 1 << shift;
+		nand->numchips = 1;
+		nand->chipsize <<= shift;
+		nand->chip_shift += shift;
+		mtd->size = nand->chipsize;
+		scale_geometry(mtd, nand, shift);
+		DBG_INFO("interleave %d chips\n", way_num);
+	}
+
+	if (plane_num > 1 || way_num > 1 || mtd->writesize > NAND_MAX_PAGESIZE) {
+		// nand_base buffers are sized for NAND_MAX_PAGESIZE, data buffer
+		// is the last member so just extend it
+		nand->buffers = kmalloc(sizeof(*nand->buffers) + mtd->writesize + mtd->oobsize, GFP_KERNEL);
+		if (nand->buffers == NULL) {
+			ERR_INFO("alloc nand buffers fail\n");
+			err = -ENOMEM;
+			goto out;
+		}
+		nand->options |= NAND_OWN_BUFFERS;
+	}
+
+	// two planes are read separately after loaded together, chips are
+	// not selected one by one for a page
+	if (cache_read_switch && plane_num == 1 && way_num == 1 &&
+		(chip_param->options & SUNXI_NAND_CACHE_READ)) {
+		cache_read_on = 1;
+		DBG_INFO("cache read is on\n");
+	}
+
+	if (cache_prog_switch && plane_num == 1 && way_num == 1 &&
+		(chip_param->options & SUNXI_NAND_CACHE_PROG)) {
+		nand->write_page = nfc_write_page_cached;
+		DBG_INFO("cache program is on\n");
+	}
+
 	// setup ECC layout
 	sunxi_ecclayout.eccbytes = 0;
 	sunxi_ecclayout.oobavail = mtd->writesize / 1024 * 4 - 2;
 	sunxi_ecclayout.oobfree->offset = 1;
 	sunxi_ecclayout.oobfree->length = mtd->writesize / 1024 * 4 - 2;
 	nand->ecc.layout = &sunxi_ecclayout;
-	nand->ecc.size = mtd->writesize;
+	// ECC is done in 1K sector, nand_base enables sub-page write when a
+	// page has 2 or more sectors, erased sectors left by it are told by
+	// ecc_decode(). Only SLC chips take partial page programs, and blank
+	// sectors can't be told from random data.
+	if (subpage_switch && !random_switch && nfc_chip_is_slc(nand, id))
+		nand->ecc.size = 1024;
+	else {
+		nand->options |= NAND_NO_SUBPAGE_WRITE;
+		nand->ecc.size = mtd->writesize;
+	}
 	nand->ecc.bytes = 0;
 
 	// setup DMA
@@ -1115,8 +3374,9 @@ int nfc_second_init(struct mtd_info *mtd)
 		goto out;
 	}
 
-	// alloc buffer
-	buffer_size = mtd->writesize + 1024;
+	// alloc buffer, OOB of two planes or interleaved chips may be larger
+	// than 1K
+	buffer_size = mtd->writesize + max_t(int, 1024, mtd->oobsize);
 	read_buffer = kmalloc(buffer_size, GFP_KERNEL);
 	if (read_buffer == NULL) {
 		ERR_INFO("alloc read buffer fail\n");
@@ -1143,8 +3403,24 @@ int nfc_second_init(struct mtd_info *mtd)
 		goto free_write_out;
 	}
 
+	// command finish by interrupt from now on
+	if (irq_switch) {
+		nfc_int_mask = NFC_CMD_INT_ENABLE;
+		writel(nfc_int_mask, NFC_REG_INT);
+	}
+
+	nfc_calibrate(chip_param->clock_freq);
+
+	if (bench_switch)
+		bench_xfer_desc();
+
+	nfc_debugfs = debugfs_create_dir("sunxi_nand", NULL);
+	if (!IS_ERR_OR_NULL(nfc_debugfs))
+		debugfs_create_u64("sched_read_wait_us", S_IRUGO, nfc_debugfs, &sched_read_wait_us);
+
 	// test command
 	//test_nfc(mtd);
+	//test_oob(mtd, 1280);
 	//test_ops(mtd);
 	//print_page(mtd, 0);
 
@@ -1162,12 +3438,19 @@ out:
 
 void nfc_exit(struct mtd_info *mtd)
 {
+	if (!IS_ERR_OR_NULL(nfc_debugfs))
+		debugfs_remove_recursive(nfc_debugfs);
+	nfc_debugfs = NULL;
+	nfc_int_mask = 0;
+	writel(0, NFC_REG_INT);
 	free_irq(SW_INT_IRQNO_NAND, mtd);
 	dma_unmap_single(NULL, read_buffer_dma, buffer_size, DMA_FROM_DEVICE);
 	dma_unmap_single(NULL, write_buffer_dma, buffer_size, DMA_TO_DEVICE);
 	dma_nand_release(dma_hdle);
 	kfree(write_buffer);
 	kfree(read_buffer);
+	if (((struct nand_chip *)mtd->priv)->options & NAND_OWN_BUFFERS)
+		kfree(((struct nand_chip *)mtd->priv)->buffers);
 	sunxi_release_nand_pio();
 	release_nand_clock();
 }
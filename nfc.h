@@ -20,11 +20,36 @@
 #ifndef _SUNXI_NAND_NFC_H
 #define _SUNXI_NAND_NFC_H
 
+#include <linux/list.h>
+#include <linux/ktime.h>
+
+// A10 NFC has 8 CE pins
+#define NFC_MAX_CHIP_NUM 8
+
+// one NAND operation run under the NFC arbitration lock
+struct nfc_op {
+	struct list_head list;
+	// issue the operation and wait for its finish, the NFC is owned
+	void (*run)(struct nfc_op *op);
+	struct mtd_info *mtd;
+	unsigned command;   // NAND_CMD_* the op is for
+	int column, page, len;
+	void *buf, *oob;
+	int result;
+	// arbitration lock private
+	ktime_t submit_time;
+	unsigned int bypass;
+};
+
+int nfc_op_run(struct nfc_op *op);
+
 void nfc_read_page1k(uint32_t page_addr, void *buff);
 void nfc_write_page1k(uint32_t page_addr, void *buff);
 
 int nfc_first_init(struct mtd_info *mtd);
+int nfc_max_chips(void);
 int nfc_second_init(struct mtd_info *mtd);
+void nfc_setup_mtd_ops(struct mtd_info *mtd);
 void nfc_exit(struct mtd_info *mtd);
 
 #endif
@@ -91,8 +91,15 @@
 #define NFC_PAGE_SIZE			(0xf << 8)
 #define NFC_SAM					(1 << 12)
 #define NFC_RAM_METHOD			(1 << 14)
+#define NFC_DDR_TYPE			(3 << 18)	// data interface, SDR by default
+#define NFC_DDR_TYPE_ONFI		(2 << 18)
+#define NFC_DDR_TYPE_TOGGLE		(3 << 18)
 #define NFC_DEBUG_CTL			(1 << 31)
 
+/*define bit use in NFC_TIMING_CTL*/
+#define NFC_TIMING_DC_CTL		(0x3f << 0)	// DQS delay chain of DDR data sampling
+#define NFC_TIMING_EDO			(1 << 8)	// serial access mode, sample on the next RE edge
+
 /*define bit use in NFC_ST*/
 #define NFC_RB_B2R				(1 << 0)
 #define NFC_CMD_INT_FLAG		(1 << 1)